@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "asm/types.h"
+
+#include "bch.h"
+
+/* x^13 + x^4 + x^3 + x + 1 */
+#define BCH_POLY	(0x201B)
+
+/* parity register words, the parity left aligned from bit 31 of word 0 */
+#define BCH_WORDS(t)	((BCH_BITS(t) + 31) / 32)
+#define BCH_MAX_WORDS	BCH_WORDS(BCH_MAX_T)
+
+static u16 gf_exp[2 * BCH_N];
+static u16 gf_log[BCH_N + 1];
+
+/* remainder of each byte value times x^deg, for t = 4 and t = 8 */
+static u32 bch4_table[256][BCH_WORDS(BCH4_T)];
+static u32 bch8_table[256][BCH_WORDS(BCH8_T)];
+
+static inline u16 gf_mul(u16 a, u16 b)
+{
+	if (!a || !b)
+		return 0;
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static inline u16 gf_div(u16 a, u16 b)
+{
+	if (!a)
+		return 0;
+	return gf_exp[gf_log[a] + BCH_N - gf_log[b]];
+}
+
+static inline u32 *bch_table(int t, int i)
+{
+	return (t == BCH4_T) ? bch4_table[i] : bch8_table[i];
+}
+
+/*
+ * The generator is the product of the minimal polynomials of alpha,
+ * alpha^3, ... alpha^(2t-1), each a product over its conjugates.
+ */
+static int bch_generator(int t, u8 *g)
+{
+	u16 m[BCH_M + 1];
+	u8 p[BCH_BITS(BCH_MAX_T) + 1];
+	int i, j, k, deg, mdeg;
+	u16 root;
+
+	memset(g, 0, BCH_BITS(t) + 1);
+	g[0] = 1;
+	deg = 0;
+
+	for (i = 1; i < 2 * t; i += 2) {
+		memset(m, 0, sizeof(m));
+		m[0] = 1;
+		mdeg = 0;
+		root = gf_exp[i];
+		do {
+			/* m(x) *= (x + root) */
+			for (k = ++mdeg; k > 0; k--)
+				m[k] = m[k - 1] ^ gf_mul(m[k], root);
+			m[0] = gf_mul(m[0], root);
+			root = gf_mul(root, root);
+		} while (root != gf_exp[i]);
+
+		/* g(x) *= m(x), both binary */
+		memset(p, 0, sizeof(p));
+		for (j = 0; j <= deg; j++)
+			for (k = 0; k <= mdeg && g[j]; k++)
+				p[j + k] ^= m[k] & 1;
+		deg += mdeg;
+		memcpy(g, p, deg + 1);
+	}
+
+	return deg;
+}
+
+static void bch_init_table(int t)
+{
+	u8 g[BCH_BITS(BCH_MAX_T) + 1];
+	u32 gw[BCH_MAX_WORDS], r[BCH_MAX_WORDS];
+	int words = BCH_WORDS(t), deg;
+	int i, j, bit, fb;
+
+	deg = bch_generator(t, g);
+
+	/* g without x^deg, left aligned */
+	memset(gw, 0, sizeof(gw));
+	for (i = 0; i < deg; i++)
+		if (g[deg - 1 - i])
+			gw[i / 32] |= 0x80000000 >> (i % 32);
+
+	for (i = 0; i < 256; i++) {
+		memset(r, 0, sizeof(r));
+		for (bit = 7; bit >= 0; bit--) {
+			fb = (r[0] >> 31) ^ ((i >> bit) & 1);
+			for (j = 0; j < words - 1; j++)
+				r[j] = (r[j] << 1) | (r[j + 1] >> 31);
+			r[words - 1] <<= 1;
+			if (fb)
+				for (j = 0; j < words; j++)
+					r[j] ^= gw[j];
+		}
+		memcpy(bch_table(t, i), r, words * 4);
+	}
+}
+
+void bch_init(void)
+{
+	u32 x = 1;
+	int i;
+
+	for (i = 0; i < BCH_N; i++) {
+		gf_exp[i] = x;
+		gf_exp[i + BCH_N] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & (1 << BCH_M))
+			x ^= BCH_POLY;
+	}
+	gf_log[0] = 0;
+
+	bch_init_table(BCH4_T);
+	bch_init_table(BCH8_T);
+}
+
+static void bch_remainder(int t, const u8 *data, int len, u32 *r)
+{
+	int words = BCH_WORDS(t);
+	const u32 *tab;
+	int i, j;
+
+	memset(r, 0, words * 4);
+	for (i = 0; i < len; i++) {
+		tab = bch_table(t, (r[0] >> 24) ^ data[i]);
+		for (j = 0; j < words - 1; j++)
+			r[j] = ((r[j] << 8) | (r[j + 1] >> 24)) ^ tab[j];
+		r[words - 1] = (r[words - 1] << 8) ^ tab[words - 1];
+	}
+}
+
+/* parity of len bytes, most significant bit first, for t = 4 or 8 */
+void bch_encode(int t, const u8 *data, int len, u8 *ecc)
+{
+	u32 r[BCH_MAX_WORDS];
+	int i;
+
+	bch_remainder(t, data, len, r);
+	for (i = 0; i < BCH_BYTES(t); i++)
+		ecc[i] = r[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/*
+ * The odd syndromes of data plus stored parity, from the remainder of
+ * the received codeword.  Returns 0 when they are all zero.
+ */
+int bch_syndromes(int t, const u8 *data, int len, const u8 *ecc, u16 *syn)
+{
+	u32 r[BCH_MAX_WORDS];
+	int i, j, k, nonzero = 0;
+
+	bch_remainder(t, data, len, r);
+	for (i = 0; i < BCH_BYTES(t); i++)
+		r[i / 4] ^= (u32)ecc[i] << (24 - (i % 4) * 8);
+
+	memset(syn, 0, t * sizeof(*syn));
+	for (k = 0; k < BCH_BITS(t); k++) {
+		if (!(r[k / 32] & (0x80000000 >> (k % 32))))
+			continue;
+
+		/* bit k from the left is the coefficient of x^(deg-1-k) */
+		j = BCH_BITS(t) - 1 - k;
+		for (i = 0; i < t; i++)
+			syn[i] ^= gf_exp[((2 * i + 1) * j) % BCH_N];
+		nonzero = 1;
+	}
+
+	return nonzero;
+}
+
+/*
+ * Corrects up to t bit errors in len bytes of data, given the odd
+ * syndromes S1, S3, ... S(2t-1).  The codeword is the data, most
+ * significant bit of the first byte first, followed by the parity
+ * bits.  Returns the number of bits corrected (including any in the
+ * parity itself), or -EBADMSG if the data is uncorrectable.
+ */
+int bch_correct(int t, u8 *data, int len, const u16 *syn)
+{
+	u16 s[2 * BCH_MAX_T + 1];
+	u16 c[BCH_MAX_T + 2], b[BCH_MAX_T + 2], tmp[BCH_MAX_T + 2];
+	u16 d, bd, term;
+	int pos[BCH_MAX_T];
+	int i, j, n, k, l, m, roots, nbits, pbits;
+
+	/* the even syndromes follow from S2i = Si^2 */
+	for (i = 0; i < t; i++)
+		s[2 * i + 1] = syn[i];
+	for (i = 2; i <= 2 * t; i += 2)
+		s[i] = gf_mul(s[i / 2], s[i / 2]);
+
+	for (i = 1; i <= 2 * t; i++)
+		if (s[i])
+			break;
+	if (i > 2 * t)
+		return 0;
+
+	/* Berlekamp-Massey, c is the error locator polynomial */
+	memset(c, 0, sizeof(c));
+	memset(b, 0, sizeof(b));
+	c[0] = b[0] = 1;
+	l = 0;
+	m = 1;
+	bd = 1;
+
+	for (n = 0; n < 2 * t; n++) {
+		d = s[n + 1];
+		for (i = 1; i <= l; i++)
+			d ^= gf_mul(c[i], s[n + 1 - i]);
+
+		if (!d) {
+			m++;
+			continue;
+		}
+
+		memcpy(tmp, c, sizeof(tmp));
+		for (i = 0; i + m <= t + 1; i++)
+			c[i + m] ^= gf_mul(gf_div(d, bd), b[i]);
+
+		if (2 * l <= n) {
+			l = n + 1 - l;
+			memcpy(b, tmp, sizeof(b));
+			bd = d;
+			m = 1;
+		} else {
+			m++;
+		}
+	}
+
+	if (l > t)
+		return -EBADMSG;
+
+	/* Chien search over the shortened codeword */
+	pbits = BCH_BITS(t);
+	nbits = len * 8 + pbits;
+	roots = 0;
+	for (j = 0; j < nbits; j++) {
+		term = c[0];
+		for (i = 1; i <= l; i++) {
+			if (!c[i])
+				continue;
+			term ^= gf_exp[(gf_log[c[i]] +
+					(BCH_N - j) * i) % BCH_N];
+		}
+		if (term)
+			continue;
+
+		if (roots == l)
+			return -EBADMSG;
+		pos[roots++] = j;
+	}
+
+	if (roots != l)
+		return -EBADMSG;
+
+	for (i = 0; i < roots; i++) {
+		k = pos[i] - pbits;
+		if (k < 0)
+			continue; /* in the parity */
+
+		k = len * 8 - 1 - k;
+		data[k >> 3] ^= 0x80 >> (k & 7);
+	}
+
+	return roots;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _BCH_H
+#define _BCH_H
+
+#include "asm/types.h"
+
+/* binary BCH over GF(2^13), 4-bit as computed by the MCUS ECC engine */
+#define BCH_M		(13)
+#define BCH_N		((1 << BCH_M) - 1)
+#define BCH_MAX_T	(8)
+#define BCH_STEP	(512)
+
+#define BCH_BITS(t)	(BCH_M * (t))
+#define BCH_BYTES(t)	((BCH_BITS(t) + 7) / 8)
+
+#define BCH4_T		(4)
+#define BCH4_BYTES	BCH_BYTES(4) /* 52 parity bits */
+#define BCH8_T		(8)
+#define BCH8_BYTES	BCH_BYTES(8) /* 104 parity bits */
+
+void bch_init(void);
+void bch_encode(int t, const u8 *data, int len, u8 *ecc);
+int bch_syndromes(int t, const u8 *data, int len, const u8 *ecc, u16 *syn);
+int bch_correct(int t, u8 *data, int len, const u16 *syn);
+
+#endif /* _BCH_H */
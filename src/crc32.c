@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdbool.h>
+
+#include "asm/types.h"
+
+#include "crc32.h"
+
+/* reflected IEEE 802.3 polynomial, as used by zlib */
+#define CRC32_POLY	(0xEDB88320)
+
+static u32 crc32_table[256];
+static bool crc32_ready;
+
+static void crc32_init(void)
+{
+	u32 c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		crc32_table[i] = c;
+	}
+	crc32_ready = true;
+}
+
+/* start with crc = 0; pass the previous result to continue */
+u32 crc32(u32 crc, const void *buf, int len)
+{
+	const u8 *p = buf;
+
+	if (!crc32_ready)
+		crc32_init();
+
+	crc = ~crc;
+	while (len--)
+		crc = crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdbool.h>
+
+#include "asm/io.h"
+#include "asm/types.h"
+
+#include "dma.h"
+
+/* Pollux DMA controller, one 0x80 byte register bank per channel */
+#define DMA_BASE		(0xC0000000)
+#define DMA_CH(ch)		((ch) * 0x80)
+
+#define DMA_SRCADDR		(0x00)
+#define DMA_DSTADDR		(0x04)
+#define DMA_LENGTH		(0x08) /* 16 bit, bytes - 1 */
+#define DMA_REQID		(0x0A) /* 16 bit */
+#define DMA_MODE		(0x0C)
+
+#define DMA_MODE_SRCIOSIZE_16	(1 << 0)
+#define DMA_MODE_SRCIOMODE	(1 << 4)
+#define DMA_MODE_SRCNOTINC	(1 << 5)
+#define DMA_MODE_DSTIOSIZE_16	(1 << 8)
+#define DMA_MODE_DSTIOMODE	(1 << 12)
+#define DMA_MODE_DSTNOTINC	(1 << 13)
+#define DMA_MODE_BUSY		(1 << 16)
+#define DMA_MODE_INTPEND	(1 << 17)
+#define DMA_MODE_INTENB		(1 << 18)
+#define DMA_MODE_RUN		(1 << 19)
+#define DMA_MODE_STOP		(1 << 20)
+
+static void __iomem *dma_regs = (void __iomem *) DMA_BASE;
+
+static u8 dma_used;
+
+void dma_init(void)
+{
+	int ch;
+
+	for (ch = 0; ch < DMA_MAX_CHANNELS; ch++)
+		writel(DMA_MODE_STOP | DMA_MODE_INTPEND,
+				dma_regs + DMA_CH(ch) + DMA_MODE);
+	dma_used = 0;
+}
+
+int dma_request(void)
+{
+	int ch;
+
+	for (ch = 0; ch < DMA_MAX_CHANNELS; ch++) {
+		if (!(dma_used & (1 << ch))) {
+			dma_used |= 1 << ch;
+			return ch;
+		}
+	}
+
+	return -1;
+}
+
+void dma_free(int ch)
+{
+	if (ch < 0 || ch >= DMA_MAX_CHANNELS)
+		return;
+
+	dma_stop(ch);
+	dma_used &= ~(1 << ch);
+}
+
+static void dma_start(int ch, u32 src, u32 dst, u32 length, u8 reqid,
+		u32 mode)
+{
+	void __iomem *regs = dma_regs + DMA_CH(ch);
+
+	writel(src, regs + DMA_SRCADDR);
+	writel(dst, regs + DMA_DSTADDR);
+	writew(length - 1, regs + DMA_LENGTH);
+	writew(reqid, regs + DMA_REQID);
+	writel(mode | DMA_MODE_INTPEND | DMA_MODE_RUN, regs + DMA_MODE);
+}
+
+/* memory to 16-bit peripheral FIFO, paced by the peripheral request */
+void dma_to_io(int ch, const void *src, void __iomem *dst, u32 length,
+		u8 reqid)
+{
+	dma_start(ch, (u32)src, (u32)dst, length, reqid,
+			DMA_MODE_DSTIOMODE | DMA_MODE_DSTIOSIZE_16 |
+			DMA_MODE_DSTNOTINC);
+}
+
+/* 16-bit peripheral FIFO to memory, paced by the peripheral request */
+void dma_from_io(int ch, void __iomem *src, void *dst, u32 length,
+		u8 reqid)
+{
+	dma_start(ch, (u32)src, (u32)dst, length, reqid,
+			DMA_MODE_SRCIOMODE | DMA_MODE_SRCIOSIZE_16 |
+			DMA_MODE_SRCNOTINC);
+}
+
+bool dma_busy(int ch)
+{
+	return (readl(dma_regs + DMA_CH(ch) + DMA_MODE) & DMA_MODE_BUSY) != 0;
+}
+
+/* returns the number of bytes that were not transferred */
+u32 dma_stop(int ch)
+{
+	void __iomem *regs = dma_regs + DMA_CH(ch);
+	u32 mode;
+
+	mode = readl(regs + DMA_MODE);
+	if (!(mode & DMA_MODE_BUSY))
+		return 0;
+
+	writel((mode & ~DMA_MODE_RUN) | DMA_MODE_STOP, regs + DMA_MODE);
+	while (readl(regs + DMA_MODE) & DMA_MODE_BUSY)
+		;
+
+	return (u32)readw(regs + DMA_LENGTH) + 1;
+}
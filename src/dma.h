@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _DMA_H
+#define _DMA_H
+
+#include <stdbool.h>
+
+#include "asm/types.h"
+
+#define DMA_MAX_CHANNELS (8)
+#define DMA_MAX_LENGTH   (0x10000) /* 64 KiB per transfer */
+
+/* peripheral request ids */
+#define DMA_REQID_UDC_EP1 (12)
+#define DMA_REQID_UDC_EP2 (13)
+
+void dma_init(void);
+int dma_request(void);
+void dma_free(int ch);
+void dma_to_io(int ch, const void *src, void __iomem *dst, u32 length,
+		u8 reqid);
+void dma_from_io(int ch, void __iomem *src, void *dst, u32 length,
+		u8 reqid);
+bool dma_busy(int ch);
+u32 dma_stop(int ch);
+
+#endif /* _DMA_H */
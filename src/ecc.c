@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+
+#include "asm/types.h"
+
+#include "bch.h"
+#include "ecc.h"
+
+/*
+ * Software ECC over 512 byte steps, for layouts and strengths the MCUS
+ * engine can't do.  Nothing here touches hardware.
+ */
+
+/* bits of a word with bit address line 0-4 high */
+static const u32 hamming_mask[5] = {
+	0xAAAAAAAA, 0xCCCCCCCC, 0xF0F0F0F0, 0xFF00FF00, 0xFFFF0000,
+};
+
+static inline u32 parity32(u32 x)
+{
+	x ^= x >> 16;
+	x ^= x >> 8;
+	x ^= x >> 4;
+	x &= 0xF;
+	return (0x6996 >> x) & 1;
+}
+
+/*
+ * 1-bit Hamming code: for each of the 12 bit address lines of the step,
+ * the parity of the bits with that line high and of those with it low.
+ * Works a 32-bit word at a time; lines 0-4 address bits within a word
+ * and come from the XOR of all words, lines 5-11 select the word.
+ */
+static u32 hamming_calculate(const u8 *data)
+{
+	const u32 *p = (const u32 *)data;
+	u32 all = 0, line[7] = {0};
+	u32 w, ecc = 0, total, p1;
+	int i, k;
+
+	for (i = 0; i < ECC_STEP / 4; i++) {
+		w = *p++;
+		all ^= w;
+		for (k = 0; k < 7; k++)
+			if (i & (1 << k))
+				line[k] ^= w;
+	}
+
+	total = parity32(all);
+	for (k = 0; k < 12; k++) {
+		if (k < 5)
+			p1 = parity32(all & hamming_mask[k]);
+		else
+			p1 = parity32(line[k - 5]);
+		ecc |= (p1 << (2 * k + 1)) | ((p1 ^ total) << (2 * k));
+	}
+
+	return ecc;
+}
+
+static int hamming_correct(u8 *data, const u8 *ecc)
+{
+	u32 stored, s, addr = 0;
+	int k;
+
+	stored = ecc[0] | (ecc[1] << 8) | (ecc[2] << 16);
+	s = stored ^ hamming_calculate(data);
+	if (!s)
+		return 0;
+
+	/* a single bit error flips exactly one of every pair */
+	if (((s ^ (s >> 1)) & 0x555555) == 0x555555) {
+		for (k = 0; k < 12; k++)
+			if (s & (1 << (2 * k + 1)))
+				addr |= 1 << k;
+
+		/* little endian word layout, see hamming_calculate */
+		data[addr >> 3] ^= 1 << (addr & 7);
+		return 1;
+	}
+
+	/* the error was in the ECC bytes */
+	if (!(s & (s - 1)))
+		return 1;
+
+	return -EBADMSG;
+}
+
+int ecc_bytes(int algo)
+{
+	switch (algo) {
+	case ECC_HAMMING:
+		return 3;
+	case ECC_HW_BCH4:
+	case ECC_BCH4:
+		return BCH4_BYTES;
+	case ECC_BCH8:
+		return BCH8_BYTES;
+	default:
+		return 0;
+	}
+}
+
+void ecc_calculate(int algo, const u8 *data, u8 *ecc)
+{
+	u32 h;
+
+	switch (algo) {
+	case ECC_HAMMING:
+		h = hamming_calculate(data);
+		ecc[0] = h;
+		ecc[1] = h >> 8;
+		ecc[2] = h >> 16;
+		break;
+	case ECC_BCH4:
+		bch_encode(BCH4_T, data, ECC_STEP, ecc);
+		break;
+	case ECC_BCH8:
+		bch_encode(BCH8_T, data, ECC_STEP, ecc);
+		break;
+	}
+}
+
+/* returns the bits corrected in a step, or -EBADMSG */
+int ecc_correct(int algo, u8 *data, const u8 *ecc)
+{
+	u16 syn[BCH_MAX_T];
+	int t;
+
+	switch (algo) {
+	case ECC_HAMMING:
+		return hamming_correct(data, ecc);
+	case ECC_BCH4:
+	case ECC_BCH8:
+		t = (algo == ECC_BCH4) ? BCH4_T : BCH8_T;
+		if (!bch_syndromes(t, data, ECC_STEP, ecc, syn))
+			return 0;
+		return bch_correct(t, data, ECC_STEP, syn);
+	default:
+		return -EINVAL;
+	}
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _ECC_H
+#define _ECC_H
+
+#include "asm/types.h"
+
+#define ECC_STEP	(512)
+#define ECC_MAX_BYTES	(13)
+
+/* nand_chip.ecc_algo */
+enum ecc_algo {
+	ECC_HW_BCH4 = 0,	/* MCUS engine, computed inline */
+	ECC_HAMMING,		/* 1-bit, 3 bytes per step */
+	ECC_BCH4,		/* 4-bit, 7 bytes per step */
+	ECC_BCH8,		/* 8-bit, 13 bytes per step */
+	NUM_ECC_ALGOS,
+};
+
+int ecc_bytes(int algo);
+void ecc_calculate(int algo, const u8 *data, u8 *ecc);
+int ecc_correct(int algo, u8 *data, const u8 *ecc);
+
+#endif /* _ECC_H */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "asm/types.h"
+
+#include "event.h"
+#include "irq.h"
+
+static struct event *event_queue[EVENT_QUEUE_LEN];
+static unsigned int event_head;
+static unsigned int event_tail;
+
+/*
+ * Queues a work item for the main loop.  Safe from interrupt handlers;
+ * an event that is already pending is not queued twice.
+ */
+int event_post(struct event *ev)
+{
+	u32 flags;
+	int ret = 0;
+
+	flags = irq_save();
+	if (ev->pending)
+		goto out;
+
+	if (event_tail - event_head >= EVENT_QUEUE_LEN) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	ev->pending = true;
+	event_queue[event_tail++ % EVENT_QUEUE_LEN] = ev;
+out:
+	irq_restore(flags);
+	return ret;
+}
+
+/*
+ * Runs one work item, or sleeps until an interrupt if there is none.
+ * With IRQ_POLL it never sleeps and polls the handlers every pass.
+ */
+void event_run(void)
+{
+	struct event *ev = NULL;
+	u32 flags;
+
+	flags = irq_save();
+	if (event_head != event_tail) {
+		ev = event_queue[event_head++ % EVENT_QUEUE_LEN];
+		ev->pending = false;
+	} else if (!IRQ_POLL) {
+		cpu_idle();
+	}
+	irq_restore(flags);
+
+	if (ev)
+		ev->fn(ev->arg);
+
+	if (IRQ_POLL)
+		irq_poll();
+}
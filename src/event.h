@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _EVENT_H
+#define _EVENT_H
+
+#include <stdbool.h>
+
+#define EVENT_QUEUE_LEN (16)
+
+struct event {
+	void			(*fn)(void *arg);
+	void			*arg;
+	bool			pending;
+};
+
+int event_post(struct event *ev);
+void event_run(void);
+
+#endif /* _EVENT_H */
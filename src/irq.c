@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "asm/io.h"
+#include "asm/types.h"
+
+#include "irq.h"
+
+/* Pollux interrupt controller */
+#define INTC_BASE		(0xC0000800)
+#define INTC_MODEL		(0x08)
+#define INTC_MODEH		(0x0C)
+#define INTC_MASKL		(0x10)
+#define INTC_MASKH		(0x14)
+#define INTC_PENDL		(0x20)
+#define INTC_PENDH		(0x24)
+
+/* ARM exception vector and the literal it loads the handler from */
+#define VECTOR_IRQ		(0x18)
+#define VECTOR_IRQ_LITERAL	(0x38)
+#define LDR_PC_PC_18		(0xE59FF018)
+
+#define IRQ_STACK_SIZE		(1024)
+
+/* Thumb-1 has no MRS, MSR or MCR */
+#define ARM_CODE		__attribute__((target("arm")))
+
+static void __iomem *intc_regs = (void __iomem *) INTC_BASE;
+
+static void (*irq_handlers[NUM_IRQS])(void);
+static u32 irq_stack[IRQ_STACK_SIZE / 4];
+
+u32 ARM_CODE irq_save(void)
+{
+	u32 cpsr, tmp;
+
+	asm volatile(
+		"mrs	%0, cpsr\n"
+		"orr	%1, %0, #0x80\n"
+		"msr	cpsr_c, %1\n"
+		: "=r" (cpsr), "=r" (tmp) : : "memory");
+	return cpsr;
+}
+
+void ARM_CODE irq_restore(u32 cpsr)
+{
+	asm volatile("msr	cpsr_c, %0\n" : : "r" (cpsr) : "memory");
+}
+
+void ARM_CODE irq_enable(void)
+{
+	u32 tmp;
+
+	asm volatile(
+		"mrs	%0, cpsr\n"
+		"bic	%0, %0, #0x80\n"
+		"msr	cpsr_c, %0\n"
+		: "=r" (tmp) : : "memory");
+}
+
+/*
+ * Waits for an interrupt.  Call with IRQs masked after checking for
+ * work; the core still wakes on a pending IRQ, which is then taken as
+ * soon as the caller restores the CPSR.
+ */
+void ARM_CODE cpu_idle(void)
+{
+	asm volatile("mcr	p15, 0, %0, c7, c0, 4\n" : : "r" (0) : "memory");
+}
+
+static void irq_dispatch(u32 pend, int base)
+{
+	int irq;
+
+	while (pend) {
+		irq = __builtin_ctz(pend);
+		pend &= ~(1 << irq);
+
+		if (irq_handlers[base + irq])
+			irq_handlers[base + irq]();
+	}
+}
+
+/*
+ * Entered from the vector's ldr pc, which on ARMv5 picks the state from
+ * bit 0 of the address: an ARM function keeps the core in ARM state.
+ */
+void ARM_CODE __attribute__((interrupt("IRQ"))) irq_handler(void)
+{
+	u32 pendl, pendh;
+
+	pendl = readl(intc_regs + INTC_PENDL) &
+			~readl(intc_regs + INTC_MASKL);
+	pendh = readl(intc_regs + INTC_PENDH) &
+			~readl(intc_regs + INTC_MASKH);
+
+	/* sources are serviced first so they deassert before the ack */
+	irq_dispatch(pendl, 0);
+	irq_dispatch(pendh, 32);
+
+	writel(pendl, intc_regs + INTC_PENDL);
+	writel(pendh, intc_regs + INTC_PENDH);
+}
+
+void ARM_CODE irq_init(void)
+{
+	u32 *stack_top = &irq_stack[IRQ_STACK_SIZE / 4];
+
+	/* everything masked, everything IRQ (not FIQ) */
+	writel(0xFFFFFFFF, intc_regs + INTC_MASKL);
+	writel(0xFFFFFFFF, intc_regs + INTC_MASKH);
+	writel(0, intc_regs + INTC_MODEL);
+	writel(0, intc_regs + INTC_MODEH);
+	writel(0xFFFFFFFF, intc_regs + INTC_PENDL);
+	writel(0xFFFFFFFF, intc_regs + INTC_PENDH);
+
+	/* IRQ mode has its own banked stack pointer */
+	asm volatile(
+		"mrs	r0, cpsr\n"
+		"bic	r1, r0, #0x1F\n"
+		"orr	r1, r1, #0xD2\n"
+		"msr	cpsr_c, r1\n"
+		"mov	sp, %0\n"
+		"msr	cpsr_c, r0\n"
+		: : "r" (stack_top) : "r0", "r1", "memory");
+
+	writel((u32)irq_handler, (void __iomem *) VECTOR_IRQ_LITERAL);
+	writel(LDR_PC_PC_18, (void __iomem *) VECTOR_IRQ);
+
+	irq_enable();
+}
+
+int irq_request(int irq, void (*handler)(void))
+{
+	void __iomem *mask;
+	u32 flags;
+
+	if (irq < 0 || irq >= NUM_IRQS || !handler)
+		return -EINVAL;
+
+	if (irq_handlers[irq])
+		return -EBUSY;
+
+	mask = intc_regs + ((irq < 32) ? INTC_MASKL : INTC_MASKH);
+
+	flags = irq_save();
+	irq_handlers[irq] = handler;
+	writel(readl(mask) & ~(1 << (irq & 31)), mask);
+	irq_restore(flags);
+
+	return 0;
+}
+
+/* services every registered source as if it had interrupted */
+void irq_poll(void)
+{
+	u32 flags;
+	int irq;
+
+	flags = irq_save();
+	for (irq = 0; irq < NUM_IRQS; irq++)
+		if (irq_handlers[irq])
+			irq_handlers[irq]();
+	irq_restore(flags);
+}
+
+void irq_free(int irq)
+{
+	void __iomem *mask;
+	u32 flags;
+
+	if (irq < 0 || irq >= NUM_IRQS)
+		return;
+
+	mask = intc_regs + ((irq < 32) ? INTC_MASKL : INTC_MASKH);
+
+	flags = irq_save();
+	writel(readl(mask) | (1 << (irq & 31)), mask);
+	irq_handlers[irq] = NULL;
+	irq_restore(flags);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include "asm/types.h"
+
+#define NUM_IRQS (64)
+
+#define IRQ_MCUS (13)
+#define IRQ_UDC  (20)
+
+/*
+ * The IRQ numbers and the INTC layout are unconfirmed.  Until they are,
+ * the main loop also runs every handler itself on each pass, so a
+ * wrong number costs latency rather than enumeration.  Build with
+ * -DIRQ_POLL=0 to rely on the interrupts alone.
+ */
+#ifndef IRQ_POLL
+#define IRQ_POLL (1)
+#endif
+
+void irq_init(void);
+int irq_request(int irq, void (*handler)(void));
+void irq_free(int irq);
+void irq_poll(void);
+
+/*
+ * The CPSR and CP15 accesses below only exist in ARM state, so these
+ * live out of line in irq.c, built as ARM code even in a Thumb build.
+ */
+u32 irq_save(void);
+void irq_restore(u32 cpsr);
+void irq_enable(void);
+void cpu_idle(void);
+
+#endif /* _IRQ_H */
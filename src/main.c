@@ -17,14 +17,19 @@
 
 #include <stdio.h>
 
+#include "event.h"
+#include "irq.h"
 #include "udc.h"
 #include "nand.h"
+#include "trace.h"
 #include "usbtool_udc_driver.h"
 
 int main(void)
 {
 	int i;
 
+	irq_init();
+	trace_init();
 	nand_init();
 	for (i = 0; i < NAND_MAX_CHIPS; i++) {
 		nand_select_chip(i);
@@ -37,8 +42,9 @@ int main(void)
 		
 	fputs("\nReady!\n", stdout);
 
+	/* runs work posted by the interrupts, or polls for it, see IRQ_POLL */
 	while (1) {
-		udc_task();
+		event_run();
 	}
 
 	return 0;
@@ -15,6 +15,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -24,7 +25,77 @@
 #include "mach/mcus.h"
 #include "mach/nand.h"
 
+#include "bch.h"
+#include "crc32.h"
+#include "ecc.h"
+#include "event.h"
+#include "irq.h"
 #include "nand.h"
+#include "trace.h"
+
+#ifndef MCUS_NFCONTROL_IRQENB
+#define MCUS_NFCONTROL_IRQENB (1 << 8)
+#endif
+
+/* MCUS BCH ECC engine, one 4-bit codeword per 512 byte step */
+#ifndef MCUS_NFECCL
+#define MCUS_NFECCL		(0x78)
+#define MCUS_NFECCH		(0x7C)
+#define MCUS_NFORGECCL		(0x80)
+#define MCUS_NFORGECCH		(0x84)
+#define MCUS_NFECCSTATUS	(0x8C)
+#define MCUS_NFSYNDROME31	(0x90)
+#define MCUS_NFSYNDROME75	(0x94)
+#endif
+#ifndef MCUS_NFCONTROL_ECCRST
+#define MCUS_NFCONTROL_ECCRST	(1 << 11)
+#endif
+#ifndef MCUS_NFECCSTATUS_ERROR
+#define MCUS_NFECCSTATUS_ERROR	(1 << 0)
+#define MCUS_NFECCSTATUS_ENCDONE (1 << 1)
+#define MCUS_NFECCSTATUS_DECDONE (1 << 2)
+#endif
+
+/* two-plane command set of the Micron and Samsung parts */
+#ifndef NAND_CMD_MULTI_PROG
+#define NAND_CMD_MULTI_PROG (0x11)
+#endif
+#ifndef NAND_CMD_MULTI_SEQIN
+#define NAND_CMD_MULTI_SEQIN (0x81)
+#endif
+#ifndef NAND_CMD_MULTI_RNDOUT
+#define NAND_CMD_MULTI_RNDOUT (0x06)
+#endif
+
+/* READ CACHE SEQUENTIAL and READ CACHE END of large page parts */
+#ifndef NAND_CMD_READ_CACHE
+#define NAND_CMD_READ_CACHE (0x31)
+#endif
+#ifndef NAND_CMD_READ_CACHE_END
+#define NAND_CMD_READ_CACHE_END (0x3F)
+#endif
+
+/* pass/fail of the previous page during cache program */
+#ifndef NAND_STATUS_FAIL_N1
+#define NAND_STATUS_FAIL_N1 (0x02)
+#endif
+
+/* on-flash bad block table, at the start of a block in the last few */
+#define NAND_BBT_MAGIC		"Bbt0"
+#define NAND_BBT_MIRROR_MAGIC	"1tbB"
+
+struct nand_bbt_header {
+	u8 magic[4];
+	u32 version;
+	u16 num_blocks;
+	u16 reserved;
+	u32 crc;	/* of the header with crc zero, then the table */
+};
+
+/* nand_op.state */
+#define NAND_OP_ISSUE	(0)
+#define NAND_OP_BUSY	(1)
+#define NAND_OP_CACHE	(2)
 
 static void __iomem *mcus_regs = (void __iomem *) MCUS_BASE;
 static void __iomem *nand_regs = (void __iomem *) NAND_BASE;
@@ -32,33 +103,98 @@ static void __iomem *nand_regs = (void __iomem *) NAND_BASE;
 static struct nand_chip nand_chips[2] = {{0}};
 struct nand_chip *nand_chip = NULL;
 
+/* set from the MCUS interrupt on the rising edge of R/B */
+static volatile bool nand_ready = false;
+
+static void nand_task_event(void *arg);
+
+static struct event nand_event = {
+	.fn = nand_task_event,
+};
+
+static struct list_head nand_queue[NAND_MAX_CHIPS] = {
+	LIST_HEAD_INIT(nand_queue[0]),
+	LIST_HEAD_INIT(nand_queue[1]),
+};
+
 static inline void nand_clear_intpend()
 {
 	u32 ctrl;
 	ctrl = readl(mcus_regs + MCUS_NFCONTROL);
 	ctrl |= MCUS_NFCONTROL_INTPEND;
 	writel(ctrl, mcus_regs + MCUS_NFCONTROL);
+	nand_ready = false;
 }
 
-static inline void nand_wait_intpend()
+static void nand_irq(void)
 {
 	u32 ctrl;
-	while (1) {
-		ctrl = readl(mcus_regs + MCUS_NFCONTROL);
-		if (ctrl & MCUS_NFCONTROL_INTPEND)
+	ctrl = readl(mcus_regs + MCUS_NFCONTROL);
+	if (ctrl & MCUS_NFCONTROL_INTPEND) {
+		writel(ctrl, mcus_regs + MCUS_NFCONTROL);
+		nand_ready = true;
+		event_post(&nand_event);
+	}
+}
+
+static inline void nand_wait_done(u32 start)
+{
+	if (nand_chip)
+		nand_chip->stats.wait_ticks += trace_time() - start;
+}
+
+/*
+ * Register polls before a wait gives up.  Counted, not timed, so a
+ * wrong trace timer can't make every wait expire at once or never; at
+ * a few hundred ns per MCUS read it is far past any erase or program.
+ */
+#define NAND_WAIT_POLLS		(1000000)
+
+static inline bool nand_wait_expired(u32 *polls)
+{
+	return ++*polls > NAND_WAIT_POLLS;
+}
+
+/*
+ * Waits for the R/B rising edge.  nand_irq usually reports it, but the
+ * latched INTPEND bit is polled too, so a missing or misrouted MCUS
+ * interrupt cannot hang us.  USB is only serviced meanwhile if its
+ * interrupt works, IRQ_POLL can't reach in here.
+ */
+static inline void nand_wait_intpend()
+{
+	u32 polls = 0, start = trace_time();
+
+	trace(TRACE_NAND_WAIT, 1);
+	while (!nand_ready) {
+		if (readl(mcus_regs + MCUS_NFCONTROL) & MCUS_NFCONTROL_INTPEND)
 			break;
+		if (nand_wait_expired(&polls)) {
+			iprintf("nand: timeout waiting for ready\n");
+			break;
+		}
 	}
+	trace(TRACE_NAND_READY, 1);
+	nand_wait_done(start);
 	nand_clear_intpend();
 }
 
 static inline void nand_wait_busy()
 {
-	u32 ctrl;
+	u32 ctrl, polls = 0, start = trace_time();
+
+	trace(TRACE_NAND_WAIT, 0);
 	while (1) {
 		ctrl = readl(mcus_regs + MCUS_NFCONTROL);
 		if (ctrl & MCUS_NFCONTROL_RNB)
 			break;
+		if (nand_wait_expired(&polls)) {
+			iprintf("nand: timeout waiting for ready\n");
+			break;
+		}
 	}
+	trace(TRACE_NAND_READY, 0);
+	nand_wait_done(start);
 	nand_clear_intpend();
 }
 
@@ -71,12 +207,40 @@ static inline int nand_wait_status()
 	return status;
 }
 
-static void nand_command(unsigned int command, int column, int page_addr)
+/*
+ * Pages and blocks by the command that starts them.  3Fh only moves the
+ * last page of a cache read out of the page register, the 31h before it
+ * already counted that page.
+ */
+static void nand_count(unsigned int command)
 {
-	if (!nand_chip || !nand_chip->info.known)
-		return;
+	switch (command) {
+	case NAND_CMD_READ0:
+	case NAND_CMD_READ_CACHE:
+		nand_chip->stats.pages_read++;
+		break;
 
-	nand_wait_busy();
+	case NAND_CMD_PAGEPROG:
+	case NAND_CMD_CACHEDPROG:
+	case NAND_CMD_MULTI_PROG:
+		nand_chip->stats.pages_programmed++;
+		break;
+
+	case NAND_CMD_ERASE1:
+		nand_chip->stats.blocks_erased++;
+		break;
+	}
+}
+
+/*
+ * Writes the command and address cycles only.  Returns true when the
+ * command starts an array operation that R/B has to be waited on for.
+ */
+static bool nand_send_command(unsigned int command, int column,
+		int page_addr)
+{
+	trace(TRACE_NAND_CMD, command);
+	nand_count(command);
 
 	if (nand_chip->info.page_size <= 512) {
 		if (command == NAND_CMD_SEQIN) {
@@ -107,8 +271,9 @@ static void nand_command(unsigned int command, int column, int page_addr)
 		case NAND_CMD_ERASE1:
 		case NAND_CMD_ERASE2:
 		case NAND_CMD_SEQIN:
+		case NAND_CMD_MULTI_SEQIN:
 		case NAND_CMD_STATUS:
-			return;
+			return false;
 		}
 	} else {
 		if (command == NAND_CMD_READOOB) {
@@ -138,21 +303,43 @@ static void nand_command(unsigned int command, int column, int page_addr)
 		case NAND_CMD_ERASE1:
 		case NAND_CMD_ERASE2:
 		case NAND_CMD_SEQIN:
+		case NAND_CMD_MULTI_SEQIN:
 		case NAND_CMD_RNDIN:
 		case NAND_CMD_STATUS:
-			return;
+			return false;
 
 		case NAND_CMD_RNDOUT:
 			writeb(NAND_CMD_RNDOUTSTART, nand_regs + NAND_CMD);
-			return;
+			return false;
 
 		case NAND_CMD_READ0:
 			writeb(NAND_CMD_READSTART, nand_regs + NAND_CMD);
 		}
 	}
 
-	nand_wait_intpend();
-	return;
+	return true;
+}
+
+/* large page address cycles, for sequences nand_send_command can't do */
+static void nand_send_address(int column, int page_addr)
+{
+	writeb(column, nand_regs + NAND_ADDR);
+	writeb(column >> 8, nand_regs + NAND_ADDR);
+	writeb(page_addr, nand_regs + NAND_ADDR);
+	writeb(page_addr >> 8, nand_regs + NAND_ADDR);
+	if (nand_chip->chip_bits > 27) /* > 128 MiB */
+		writeb(page_addr >> 16, nand_regs + NAND_ADDR);
+}
+
+static void nand_command(unsigned int command, int column, int page_addr)
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return;
+
+	nand_wait_busy();
+
+	if (nand_send_command(command, column, page_addr))
+		nand_wait_intpend();
 }
 
 /* works only with old 5-byte IDs */
@@ -176,6 +363,13 @@ static void nand_decode_ext_id()
 
 	info->oob_size = 8 << (nand_chip->page_bits - 9 +
 			((info->id[3] >> 2) & 1));
+
+	/*
+	 * Cache program doesn't imply 31h/3Fh cache read on MLC parts, so
+	 * cache read is only set from the ID table, part by part.
+	 */
+	nand_chip->cache_prog = (info->id[2] & 0x80) != 0;
+	nand_chip->cache_read = false;
 }
 
 static void nand_identify()
@@ -215,6 +409,8 @@ static void nand_identify()
 			nand_chip->page_bits = 11;
 			nand_chip->block_bits = 17;
 			nand_chip->chip_bits = 28;
+			nand_chip->cache_read = true;
+			nand_chip->cache_prog = true;
 			break;
 		}
 		break;
@@ -262,6 +458,12 @@ static void nand_identify()
 	nand_chip->pages_per_block = 1U << (nand_chip->block_bits -
 			nand_chip->page_bits);
 	nand_chip->read_size = info->page_size + info->oob_size;
+
+	/* 512 byte page parts have no cache register */
+	if (info->page_size <= 512) {
+		nand_chip->cache_read = false;
+		nand_chip->cache_prog = false;
+	}
 }
 
 static void nand_scan_bad()
@@ -289,37 +491,25 @@ static void nand_scan_bad()
 	}
 }
 
-static bool nand_block_is_bad(int block)
+static inline int nand_bbt_get(int block)
 {
-	int byte_num, shift;
-	u8 entry;
-
-	if (!nand_chip || !nand_chip->info.known)
-		return true;
+	return (nand_chip->bbt[block >> 2] >> ((block & 0x3) * 2)) & 0x3;
+}
 
-	byte_num = block >> 2;
-	shift = (block & 0x3) * 2;
+static inline void nand_bbt_set(int block, int entry)
+{
+	int shift = (block & 0x3) * 2;
 
-	entry = (nand_chip->bbt[byte_num] >> shift) & 0x03;
-	return (entry != 0);
+	nand_chip->bbt[block >> 2] &= ~(0x3 << shift);
+	nand_chip->bbt[block >> 2] |= entry << shift;
 }
 
-void nand_init(void)
+static bool nand_block_is_bad(int block)
 {
-	int chipnr;
-
-	nand_clear_intpend();
-	for (chipnr = 0; chipnr < NAND_MAX_CHIPS; chipnr++) {
-		nand_select_chip(chipnr);
-		nand_chip->num = chipnr;
+	if (!nand_chip || !nand_chip->info.known)
+		return true;
 
-		nand_identify();
-		if (nand_chip->info.known) {
-			nand_command(NAND_CMD_RESET, -1, -1);
-			nand_scan_bad();
-		}
-	}
-	nand_select_chip(-1);
+	return nand_bbt_get(block) != NAND_BBT_GOOD;
 }
 
 void nand_select_chip(int chipnr)
@@ -345,45 +535,422 @@ void nand_select_chip(int chipnr)
 	writel(val, mcus_regs + MCUS_NFCONTROL);
 }
 
-void nand_read_page(int page, void *mem, int size)
+struct nand_chip *nand_get_chip(int chipnr)
+{
+	if (chipnr < 0 || chipnr >= NAND_MAX_CHIPS)
+		return NULL;
+
+	return &nand_chips[chipnr];
+}
+
+/*
+ * The data port is read and written a word at a time.  Aligned buffers
+ * move eight words per iteration, so gcc can use ldm/stm on the memory
+ * side, and anything else goes through byte loads or stores.  size is
+ * rounded up to whole words.
+ */
+static inline void nand_read_buf(void *mem, int size)
 {
+	void __iomem *port = nand_regs + NAND_DATA;
 	u32 *p = mem;
+	u8 *b = mem;
+	u32 w;
+
+	if ((u32)mem & 3) {
+		for (; size > 0; size -= 4, b += 4) {
+			w = readl(port);
+			b[0] = w;
+			b[1] = w >> 8;
+			b[2] = w >> 16;
+			b[3] = w >> 24;
+		}
+		return;
+	}
+
+	for (; size >= 32; size -= 32, p += 8) {
+		p[0] = readl(port);
+		p[1] = readl(port);
+		p[2] = readl(port);
+		p[3] = readl(port);
+		p[4] = readl(port);
+		p[5] = readl(port);
+		p[6] = readl(port);
+		p[7] = readl(port);
+	}
+
+	for (; size > 0; size -= 4)
+		*p++ = readl(port);
+}
+
+static inline void nand_write_buf(const void *mem, int size)
+{
+	void __iomem *port = nand_regs + NAND_DATA;
+	const u32 *p = mem;
+	const u8 *b = mem;
+
+	if ((u32)mem & 3) {
+		for (; size > 0; size -= 4, b += 4)
+			writel(b[0] | (b[1] << 8) | (b[2] << 16) |
+					((u32)b[3] << 24), port);
+		return;
+	}
+
+	for (; size >= 32; size -= 32, p += 8) {
+		writel(p[0], port);
+		writel(p[1], port);
+		writel(p[2], port);
+		writel(p[3], port);
+		writel(p[4], port);
+		writel(p[5], port);
+		writel(p[6], port);
+		writel(p[7], port);
+	}
+
+	for (; size > 0; size -= 4)
+		writel(*p++, port);
+}
+
+/* one page in a single pass, the data area and the OOB to their own buffers */
+static inline void nand_read_buf_split(void *data, void *oob)
+{
+	nand_read_buf(data, nand_chip->info.page_size);
+	nand_read_buf(oob, nand_chip->info.oob_size);
+}
+
+static int nand_ecc_offset(int mode, int algo)
+{
+	int steps = nand_chip->info.page_size / ECC_STEP;
+
+	if (mode == NAND_ECC_HEAD)
+		return (nand_chip->info.page_size > 512) ? 2 : 6;
+
+	return nand_chip->info.oob_size - steps * ecc_bytes(algo);
+}
+
+/* the parity must fit the OOB and stay clear of the bad block marker */
+int nand_set_ecc(int mode, int algo)
+{
+	int steps, offset, end;
+
+	if (!nand_chip || !nand_chip->info.known)
+		return -ENODEV;
+
+	if (mode < NAND_ECC_NONE || mode > NAND_ECC_HEAD ||
+			algo < 0 || algo >= NUM_ECC_ALGOS)
+		return -EINVAL;
+
+	if (mode != NAND_ECC_NONE) {
+		steps = nand_chip->info.page_size / ECC_STEP;
+		offset = nand_ecc_offset(mode, algo);
+		end = offset + steps * ecc_bytes(algo);
+		if (offset < 0 || end > nand_chip->info.oob_size)
+			return -EINVAL;
+		if (nand_chip->info.page_size > 512 && offset < 2)
+			return -EINVAL;
+		if (nand_chip->info.page_size <= 512 &&
+				offset <= nand_chip->info.badblock_pos &&
+				end > nand_chip->info.badblock_pos)
+			return -EINVAL;
+	}
+
+	nand_chip->ecc_mode = mode;
+	nand_chip->ecc_algo = algo;
+	return 0;
+}
+
+static inline void nand_ecc_reset(void)
+{
+	u32 ctrl;
+
+	ctrl = readl(mcus_regs + MCUS_NFCONTROL) & ~MCUS_NFCONTROL_INTPEND;
+	writel(ctrl | MCUS_NFCONTROL_ECCRST, mcus_regs + MCUS_NFCONTROL);
+}
+
+/* bounded like the R/B waits, the status bits are unverified */
+static inline int nand_ecc_wait(u32 done)
+{
+	u32 polls = 0;
+
+	while (!(readl(mcus_regs + MCUS_NFECCSTATUS) & done)) {
+		if (nand_wait_expired(&polls)) {
+			iprintf("nand: timeout waiting for ECC\n");
+			return -ETIMEDOUT;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Writes a page worth of data and OOB.  With ECC enabled, parity is
+ * generated as each step streams through NAND_DATA and is stored in
+ * the OOB of mem before the OOB is written.  Returns -ETIMEDOUT if the
+ * engine never finished, the page must then not be programmed.
+ */
+static int nand_write_data(void *mem, int size)
+{
+	u8 *oob, *ecc;
+	u32 eccl, ecch;
+	int step, i;
+
+	if (!nand_chip->ecc_mode || size != nand_chip->read_size) {
+		nand_write_buf(mem, size);
+		return 0;
+	}
+
+	oob = mem + nand_chip->info.page_size;
+	ecc = oob + nand_ecc_offset(nand_chip->ecc_mode, nand_chip->ecc_algo);
+
+	if (nand_chip->ecc_algo != ECC_HW_BCH4) {
+		for (step = 0; step < nand_chip->info.page_size;
+				step += ECC_STEP) {
+			ecc_calculate(nand_chip->ecc_algo, mem + step, ecc);
+			ecc += ecc_bytes(nand_chip->ecc_algo);
+		}
+		nand_write_buf(mem, size);
+		return 0;
+	}
+
+	for (step = 0; step < nand_chip->info.page_size; step += BCH_STEP) {
+		nand_ecc_reset();
+		nand_write_buf(mem + step, BCH_STEP);
+		if (nand_ecc_wait(MCUS_NFECCSTATUS_ENCDONE))
+			return -ETIMEDOUT;
+
+		eccl = readl(mcus_regs + MCUS_NFECCL);
+		ecch = readl(mcus_regs + MCUS_NFECCH);
+		for (i = 0; i < 4; i++)
+			*ecc++ = eccl >> (i * 8);
+		for (i = 0; i < BCH4_BYTES - 4; i++)
+			*ecc++ = ecch >> (i * 8);
+	}
+
+	nand_write_buf(oob, nand_chip->info.oob_size);
+	return 0;
+}
+
+static bool nand_ecc_erased(const u8 *ecc, int len)
+{
+	while (len--)
+		if (*ecc++ != 0xFF)
+			return false;
+	return true;
+}
+
+static void nand_ecc_count(int corrected)
+{
+	if (corrected < 0)
+		nand_chip->ecc_failed++;
+	else
+		nand_chip->ecc_corrected += corrected;
+}
+
+/* software ECC: a raw page read, then each step checked in memory */
+static int nand_read_page_soft(int page, void *mem)
+{
+	int algo = nand_chip->ecc_algo;
+	int page_size = nand_chip->info.page_size;
+	u8 *ecc;
+	int step, ret, corrected = 0;
+
+	nand_command(NAND_CMD_READ0, 0, page);
+	nand_read_buf(mem, nand_chip->read_size);
+
+	ecc = mem + page_size + nand_ecc_offset(nand_chip->ecc_mode, algo);
+	for (step = 0; step < page_size; step += ECC_STEP) {
+		if (!nand_ecc_erased(ecc, ecc_bytes(algo))) {
+			ret = ecc_correct(algo, mem + step, ecc);
+			if (ret < 0) {
+				iprintf("uncorrectable page %d step %d\n",
+						page, step / ECC_STEP);
+				corrected = -EBADMSG;
+			} else if (corrected >= 0) {
+				corrected += ret;
+			}
+		}
+		ecc += ecc_bytes(algo);
+	}
+
+	nand_ecc_count(corrected);
+	return corrected;
+}
+
+/*
+ * Reads the OOB first so the engine can be given each step's stored
+ * parity, then every step, correcting from the syndromes on a mismatch.
+ * Returns the bits corrected, -EBADMSG or -ETIMEDOUT.
+ */
+static int nand_read_page_ecc(int page, void *mem)
+{
+	int page_size = nand_chip->info.page_size;
+	u8 *oob = mem + page_size, *ecc;
+	u32 eccl, ecch, syn31, syn75;
+	u16 syn[BCH4_T];
+	int step, i, ret, corrected = 0;
+	bool erased;
+
+	if (page_size <= 512) {
+		nand_command(NAND_CMD_READOOB, 0, page);
+		nand_read_buf(oob, nand_chip->info.oob_size);
+		nand_command(NAND_CMD_READ0, 0, page);
+	} else {
+		nand_command(NAND_CMD_READ0, page_size, page);
+		nand_read_buf(oob, nand_chip->info.oob_size);
+	}
+
+	ecc = oob + nand_ecc_offset(nand_chip->ecc_mode, ECC_HW_BCH4);
+	for (step = 0; step < page_size; step += BCH_STEP) {
+		eccl = ecch = 0;
+		for (i = 0; i < BCH4_BYTES; i++) {
+			if (i < 4)
+				eccl |= ecc[i] << (i * 8);
+			else
+				ecch |= ecc[i] << ((i - 4) * 8);
+		}
+		erased = nand_ecc_erased(ecc, BCH4_BYTES);
+		ecc += BCH4_BYTES;
+
+		if (page_size > 512)
+			nand_command(NAND_CMD_RNDOUT, step, -1);
+
+		writel(eccl, mcus_regs + MCUS_NFORGECCL);
+		writel(ecch, mcus_regs + MCUS_NFORGECCH);
+		nand_ecc_reset();
+		nand_read_buf(mem + step, BCH_STEP);
+		if (nand_ecc_wait(MCUS_NFECCSTATUS_DECDONE)) {
+			corrected = -ETIMEDOUT;
+			break;
+		}
+
+		/* an erased step has no parity to check against */
+		if (erased || !(readl(mcus_regs + MCUS_NFECCSTATUS) &
+				MCUS_NFECCSTATUS_ERROR))
+			continue;
+
+		syn31 = readl(mcus_regs + MCUS_NFSYNDROME31);
+		syn75 = readl(mcus_regs + MCUS_NFSYNDROME75);
+		syn[0] = syn31 & BCH_N;
+		syn[1] = (syn31 >> 13) & BCH_N;
+		syn[2] = syn75 & BCH_N;
+		syn[3] = (syn75 >> 13) & BCH_N;
+
+		ret = bch_correct(BCH4_T, mem + step, BCH_STEP, syn);
+		if (ret < 0) {
+			iprintf("uncorrectable page %d step %d\n", page,
+					step / BCH_STEP);
+			corrected = -EBADMSG;
+		} else if (corrected >= 0) {
+			corrected += ret;
+		}
+	}
+
+	nand_ecc_count(corrected);
+	return corrected;
+}
+
+/* word-wise all-0xFF check, size a multiple of 4 bytes */
+bool nand_page_erased(const void *mem, int size)
+{
+	const u32 *p = mem;
+	int words = size / 4;
+	u32 acc;
 	int i;
 
+	for (i = 0; i + 8 <= words; i += 8) {
+		acc = p[i] & p[i + 1] & p[i + 2] & p[i + 3] &
+				p[i + 4] & p[i + 5] & p[i + 6] & p[i + 7];
+		if (acc != 0xFFFFFFFF)
+			return false;
+	}
+
+	/* a 528 byte page ends halfway through a group */
+	for (; i < words; i++)
+		if (p[i] != 0xFFFFFFFF)
+			return false;
+
+	return true;
+}
+
+/* the blocking calls below must not race queued operations */
+static void nand_sync(void)
+{
+	while (!nand_idle())
+		nand_task();
+}
+
+/* returns the bits corrected by ECC, or -EBADMSG */
+int nand_read_page(int page, void *mem, int size)
+{
 	if (!nand_chip || !nand_chip->info.known)
-		return;
+		return -ENODEV;
 
+	nand_sync();
 	nand_wait_busy();
 
+	if (nand_chip->ecc_mode && size == nand_chip->read_size) {
+		if (nand_chip->ecc_algo != ECC_HW_BCH4)
+			return nand_read_page_soft(page, mem);
+		return nand_read_page_ecc(page, mem);
+	}
+
 	nand_command(NAND_CMD_READ0, 0, page);
-	for (i = 0; i < size; i += 4)
-		*p++ = readl(nand_regs + NAND_DATA);
+	nand_read_buf(mem, size);
+	return 0;
 }
 
-void nand_read_block(int block, void *mem)
+/*
+ * With cache read, each page is drained from the cache register while
+ * the chip loads the next one, so only the first page waits a full tR.
+ * With ECC, pages are read one at a time and ecc_report is filled in;
+ * a raw read leaves it all zero, as nothing was corrected.
+ * Returns the bits corrected, or -EBADMSG if any page was uncorrectable.
+ */
+int nand_read_block(int block, void *mem)
 {
-	int first_page, offset;
+	int first_page, offset, ppb, ret, corrected = 0;
 
 	if (!nand_chip || !nand_chip->info.known)
-		return;
+		return -ENODEV;
+
+	ppb = nand_chip->pages_per_block;
+	first_page = block * ppb;
+
+	if (nand_chip->ecc_mode || !nand_chip->cache_read) {
+		for (offset = 0; offset < ppb; offset++) {
+			ret = nand_read_page(first_page + offset, mem,
+					nand_chip->read_size);
+			nand_chip->ecc_report[offset] = (ret < 0) ?
+					NAND_ECC_FAILED : ret;
+			if (ret < 0)
+				corrected = ret;
+			else if (corrected >= 0)
+				corrected += ret;
+			mem += nand_chip->read_size;
+		}
+		return corrected;
+	}
 
-	first_page = block * nand_chip->pages_per_block;
-	for (offset = 0; offset < nand_chip->pages_per_block; offset++) {
-		nand_read_page(first_page + offset, mem, nand_chip->read_size);
+	memset(nand_chip->ecc_report, 0, ppb);
+
+	nand_sync();
+	nand_wait_busy();
+
+	nand_command(NAND_CMD_READ0, 0, first_page);
+	for (offset = 0; offset < ppb; offset++) {
+		nand_command((offset + 1 == ppb) ? NAND_CMD_READ_CACHE_END :
+				NAND_CMD_READ_CACHE, -1, -1);
+		nand_read_buf(mem, nand_chip->read_size);
 		mem += nand_chip->read_size;
 	}
+
+	return 0;
 }
 
-int nand_erase_block(int block)
+static int nand_erase(int block)
 {
 	int page, status;
 
-	if (!nand_chip || !nand_chip->info.known)
-		return -1;
-
-	if (nand_block_is_bad(block))
-		return -1;
-
+	nand_sync();
 	nand_wait_busy();
 
 	page = block * nand_chip->pages_per_block;
@@ -391,54 +958,752 @@ int nand_erase_block(int block)
 	nand_command(NAND_CMD_ERASE2, -1, -1);
 
 	status = nand_wait_status();
-	if (status & NAND_STATUS_FAIL)
+	if (status & NAND_STATUS_FAIL) {
+		nand_chip->stats.errors++;
 		iprintf("error erasing block %d\n", block);
+	}
 
 	return status;
 }
 
-int nand_write_page(int page, void *mem, int size) 
+int nand_erase_block(int block)
 {
-	u32 *p = mem;
-	int i, status;
-
 	if (!nand_chip || !nand_chip->info.known)
 		return -1;
 
-	if (nand_block_is_bad(page / nand_chip->pages_per_block))
+	if (nand_block_is_bad(block))
 		return -1;
 
+	return nand_erase(block);
+}
+
+static int nand_program(int page, void *mem, int size)
+{
+	int status;
+
+	nand_sync();
 	nand_wait_busy();
 
 	nand_command(NAND_CMD_SEQIN, 0, page);
-	for (i = 0; i < size; i += 4)
-		writel(*p++, nand_regs + NAND_DATA);
+	if (nand_write_data(mem, size))
+		return -ETIMEDOUT;
 	nand_command(NAND_CMD_PAGEPROG, -1, -1);
 
 	status = nand_wait_status();
-	if (status & NAND_STATUS_FAIL)
+	if (status & NAND_STATUS_FAIL) {
+		nand_chip->stats.errors++;
 		iprintf("error programming page %d\n", page);
+	}
 
 	return status;	
 }
 
+int nand_write_page(int page, void *mem, int size) 
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return -1;
+
+	if (nand_block_is_bad(page / nand_chip->pages_per_block))
+		return -1;
+
+	return nand_program(page, mem, size);
+}
+
+/* a page on every supported part covers the header and a full table */
+static u32 nand_bbt_buf[4096 / 4];
+
+static inline int nand_bbt_pages(void)
+{
+	int size = sizeof(struct nand_bbt_header) + nand_chip->num_blocks / 4;
+
+	return (size + nand_chip->info.page_size - 1) /
+			nand_chip->info.page_size;
+}
+
+static u32 nand_bbt_crc(struct nand_bbt_header *hdr)
+{
+	u32 crc, saved = hdr->crc;
+
+	hdr->crc = 0;
+	crc = crc32(0, hdr, sizeof(*hdr) + nand_chip->num_blocks / 4);
+	hdr->crc = saved;
+	return crc;
+}
+
+/* reads the table or mirror in block into nand_bbt_buf, if it is valid */
+static bool nand_bbt_read(int block)
+{
+	struct nand_bbt_header *hdr = (void *)nand_bbt_buf;
+	int page = block * nand_chip->pages_per_block;
+	void *mem = nand_bbt_buf;
+	int i;
+
+	/* data area only, so ECC never gets involved */
+	nand_read_page(page, mem, nand_chip->info.page_size);
+	if ((memcmp(hdr->magic, NAND_BBT_MAGIC, 4) != 0 &&
+			memcmp(hdr->magic, NAND_BBT_MIRROR_MAGIC, 4) != 0) ||
+			hdr->num_blocks != nand_chip->num_blocks)
+		return false;
+
+	for (i = 1; i < nand_bbt_pages(); i++) {
+		mem += nand_chip->info.page_size;
+		nand_read_page(page + i, mem, nand_chip->info.page_size);
+	}
+
+	return nand_bbt_crc(hdr) == hdr->crc;
+}
+
+/*
+ * Looks for the table and its mirror in the last NAND_BBT_BLOCKS blocks
+ * and loads the newest valid copy, a few page reads instead of a scan.
+ */
+static int nand_bbt_load(void)
+{
+	struct nand_bbt_header *hdr = (void *)nand_bbt_buf;
+	int first = nand_chip->num_blocks - NAND_BBT_BLOCKS;
+	int block, best = -1;
+	u32 version = 0;
+
+	for (block = nand_chip->num_blocks - 1; block >= first; block--) {
+		if (!nand_bbt_read(block))
+			continue;
+		if (best < 0 || hdr->version > version) {
+			best = block;
+			version = hdr->version;
+			memcpy(nand_chip->bbt, hdr + 1,
+					nand_chip->num_blocks / 4);
+		}
+	}
+
+	if (best < 0)
+		return -1;
+
+	nand_chip->bbt_version = version;
+	return 0;
+}
+
+/* writes the table and its mirror to two usable reserved blocks */
+int nand_bbt_save(void)
+{
+	struct nand_bbt_header *hdr = (void *)nand_bbt_buf;
+	const char *magic[2] = {NAND_BBT_MAGIC, NAND_BBT_MIRROR_MAGIC};
+	int first, block, page, copy, entry, i;
+	void *mem;
+
+	if (!nand_chip || !nand_chip->info.known)
+		return -ENODEV;
+
+	first = nand_chip->num_blocks - NAND_BBT_BLOCKS;
+
+	/* good blocks in the reserved area are never handed out */
+	for (block = first; block < nand_chip->num_blocks; block++)
+		if (nand_bbt_get(block) == NAND_BBT_GOOD)
+			nand_bbt_set(block, NAND_BBT_RESERVED);
+
+	block = nand_chip->num_blocks;
+	for (copy = 0; copy < 2; copy++) {
+		memset(nand_bbt_buf, 0xFF, sizeof(nand_bbt_buf));
+		memcpy(hdr->magic, magic[copy], 4);
+		hdr->version = nand_chip->bbt_version + 1;
+		hdr->num_blocks = nand_chip->num_blocks;
+		hdr->reserved = 0;
+		memcpy(hdr + 1, nand_chip->bbt, nand_chip->num_blocks / 4);
+		hdr->crc = nand_bbt_crc(hdr);
+
+		while (--block >= first) {
+			entry = nand_bbt_get(block);
+			if (entry != NAND_BBT_RESERVED)
+				continue;
+
+			if (nand_erase(block) & NAND_STATUS_FAIL)
+				goto worn;
+
+			page = block * nand_chip->pages_per_block;
+			mem = nand_bbt_buf;
+			for (i = 0; i < nand_bbt_pages(); i++) {
+				if (nand_program(page + i, mem,
+						nand_chip->info.page_size) &
+						NAND_STATUS_FAIL)
+					goto worn;
+				mem += nand_chip->info.page_size;
+			}
+			break;
+worn:
+			/* recorded in the copies written after this one */
+			nand_bbt_set(block, NAND_BBT_WORN);
+		}
+
+		if (block < first)
+			return -ENOSPC;
+	}
+
+	nand_chip->bbt_version++;
+	return 0;
+}
+
+
+/*
+ * Pages that are all 0xFF are skipped, the erase already left them so.
+ * With cache program, every page but the last programmed one is started
+ * with 15h and the next page is loaded while it programs.  The status
+ * after each 15h reports the page before it on bit 1.
+ */
 int nand_write_block(int block, void *mem)
 {
-	int first_page, offset;
+	int first_page, offset, ppb, last, prev;
 	int status;
 
 	if (!nand_chip || !nand_chip->info.known)
 		return -1;
 
-	first_page = block * nand_chip->pages_per_block;
+	ppb = nand_chip->pages_per_block;
+	first_page = block * ppb;
+
+	/* before anything is skipped, an all-0xFF image is no exception */
+	if (nand_block_is_bad(block))
+		return -1;
+
+	if (!nand_chip->cache_prog) {
+		for (offset = 0; offset < ppb; offset++) {
+			if (!nand_page_erased(mem, nand_chip->read_size)) {
+				status = nand_write_page(first_page + offset,
+						mem, nand_chip->read_size);
+				if (status < 0 || (status & NAND_STATUS_FAIL))
+					return status;
+			}
+			mem += nand_chip->read_size;
+		}
+		return 0;
+	}
+
+	for (last = ppb - 1; last >= 0; last--)
+		if (!nand_page_erased(mem + last * nand_chip->read_size,
+				nand_chip->read_size))
+			break;
+
+	nand_sync();
+
+	prev = -1;
+	for (offset = 0; offset <= last; offset++, mem += nand_chip->read_size) {
+		if (nand_page_erased(mem, nand_chip->read_size))
+			continue;
+
+		nand_command(NAND_CMD_SEQIN, 0, first_page + offset);
+		if (nand_write_data(mem, nand_chip->read_size))
+			return -ETIMEDOUT;
+		nand_command((offset == last) ? NAND_CMD_PAGEPROG :
+				NAND_CMD_CACHEDPROG, -1, -1);
+
+		status = nand_wait_status();
+		if (prev >= 0 && (status & NAND_STATUS_FAIL_N1)) {
+			nand_chip->stats.errors++;
+			iprintf("error programming page %d\n",
+					first_page + prev);
+			return status | NAND_STATUS_FAIL;
+		}
+		if (offset == last && (status & NAND_STATUS_FAIL)) {
+			nand_chip->stats.errors++;
+			iprintf("error programming page %d\n",
+					first_page + offset);
+			return status;
+		}
+		prev = offset;
+	}
+
+	return 0;
+}
+
+static inline int nand_bit_count(u32 x)
+{
+	x -= (x >> 1) & 0x55555555;
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (x * 0x01010101) >> 24;
+}
+
+/*
+ * Compares count pages read back from flash against what was written,
+ * data and OOB, and appends each page that differs to list.  Page
+ * numbers start at page.  Returns the number of entries added.
+ */
+int nand_compare_pages(int page, int count, const void *mem,
+		const void *read, struct nand_mismatch *list)
+{
+	const u32 *a = mem, *b = read;
+	int words = nand_chip->read_size / 4;
+	int n = 0, bits, i;
+
+	for (; count > 0; count--, page++) {
+		bits = 0;
+		for (i = 0; i < words; i++)
+			bits += nand_bit_count(*a++ ^ *b++);
+		if (bits) {
+			list[n].page = page;
+			list[n].bits = bits;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* data and OOB of the largest supported page */
+static u32 nand_verify_buf[(4096 + 256) / 4];
+
+/* raw reads of a block just written, compared against mem */
+int nand_verify_block(int block, const void *mem, struct nand_mismatch *list)
+{
+	int page = block * nand_chip->pages_per_block;
+	int n = 0, offset;
+
+	nand_sync();
+
 	for (offset = 0; offset < nand_chip->pages_per_block; offset++) {
-		status = nand_write_page(first_page + offset, mem,
-				nand_chip->read_size);
-		if (status & NAND_STATUS_FAIL)
+		nand_wait_busy();
+		nand_command(NAND_CMD_READ0, 0, page + offset);
+		nand_read_buf(nand_verify_buf, nand_chip->read_size);
+		n += nand_compare_pages(page + offset, 1, mem,
+				nand_verify_buf, list + n);
+		mem += nand_chip->read_size;
+	}
+
+	return n;
+}
+
+/*
+ * Two-plane operations work on an even block and the odd block after
+ * it, which sit in different planes.  Anything else falls back to two
+ * single-plane operations.
+ */
+static bool nand_block_pair_ok(int block)
+{
+	if (nand_chip->info.num_planes < 2 || (block & 1) ||
+			block + 1 >= nand_chip->num_blocks)
+		return false;
+
+	return !nand_block_is_bad(block) && !nand_block_is_bad(block + 1);
+}
+
+int nand_erase_block_pair(int block)
+{
+	int page, status;
+
+	if (!nand_chip || !nand_chip->info.known)
+		return -1;
+
+	if (!nand_block_pair_ok(block)) {
+		status = nand_erase_block(block);
+		if (status < 0 || (status & NAND_STATUS_FAIL))
 			return status;
+		return nand_erase_block(block + 1);
+	}
+
+	nand_sync();
+	nand_wait_busy();
+
+	page = block * nand_chip->pages_per_block;
+	nand_command(NAND_CMD_ERASE1, -1, page);
+	nand_command(NAND_CMD_ERASE1, -1, page + nand_chip->pages_per_block);
+	nand_command(NAND_CMD_ERASE2, -1, -1);
+
+	status = nand_wait_status();
+	if (status & NAND_STATUS_FAIL) {
+		nand_chip->stats.errors++;
+		iprintf("error erasing blocks %d-%d\n", block, block + 1);
+	}
+
+	return status;
+}
+
+/* mem holds all pages of block, followed by all pages of block + 1 */
+int nand_write_block_pair(int block, void *mem)
+{
+	int ppb, page, offset, status;
+	void *mem2;
+
+	if (!nand_chip || !nand_chip->info.known)
+		return -1;
+
+	ppb = nand_chip->pages_per_block;
+	mem2 = mem + ppb * nand_chip->read_size;
+
+	if (!nand_block_pair_ok(block)) {
+		status = nand_write_block(block, mem);
+		if (status < 0 || (status & NAND_STATUS_FAIL))
+			return status;
+		return nand_write_block(block + 1, mem2);
+	}
+
+	nand_sync();
+
+	page = block * ppb;
+	for (offset = 0; offset < ppb; offset++) {
+		if (nand_page_erased(mem, nand_chip->read_size) &&
+				nand_page_erased(mem2, nand_chip->read_size))
+			goto next;
+
+		nand_wait_busy();
+
+		/* the dummy program only loads plane 0, a short busy */
+		nand_command(NAND_CMD_SEQIN, 0, page + offset);
+		if (nand_write_data(mem, nand_chip->read_size))
+			return -ETIMEDOUT;
+		nand_command(NAND_CMD_MULTI_PROG, -1, -1);
+
+		nand_command((nand_chip->info.page_size <= 512) ?
+				NAND_CMD_MULTI_SEQIN : NAND_CMD_SEQIN,
+				0, page + ppb + offset);
+		if (nand_write_data(mem2, nand_chip->read_size))
+			return -ETIMEDOUT;
+		nand_command(NAND_CMD_PAGEPROG, -1, -1);
+
+		status = nand_wait_status();
+		if (status & NAND_STATUS_FAIL) {
+			nand_chip->stats.errors++;
+			iprintf("error programming pages %d, %d\n",
+					page + offset, page + ppb + offset);
+			return status;
+		}
+next:
+		mem += nand_chip->read_size;
+		mem2 += nand_chip->read_size;
+	}
+
+	return 0;
+}
+
+/* as nand_read_block: the bits corrected in both blocks, or -EBADMSG */
+int nand_read_block_pair(int block, void *mem)
+{
+	int ppb, page, offset, ret, ret2;
+	void *mem2;
+
+	if (!nand_chip || !nand_chip->info.known)
+		return -ENODEV;
+
+	ppb = nand_chip->pages_per_block;
+	mem2 = mem + ppb * nand_chip->read_size;
+
+	/* small page parts have no two-plane read */
+	if (!nand_block_pair_ok(block) ||
+			nand_chip->info.page_size <= 512 ||
+			nand_chip->ecc_mode) {
+		ret = nand_read_block(block, mem);
+		ret2 = nand_read_block(block + 1, mem2);
+		if (ret < 0 || ret2 < 0)
+			return (ret < 0) ? ret : ret2;
+		return ret + ret2;
+	}
+
+	/* raw, like the cache read branch of nand_read_block */
+	memset(nand_chip->ecc_report, 0, ppb);
+
+	nand_sync();
+
+	page = block * ppb;
+	for (offset = 0; offset < ppb; offset++) {
+		nand_wait_busy();
+
+		/* both planes load their page register in one busy period */
+		nand_chip->stats.pages_read += 2;
+		writeb(NAND_CMD_READ0, nand_regs + NAND_CMD);
+		nand_send_address(0, page + offset);
+		writeb(NAND_CMD_READ0, nand_regs + NAND_CMD);
+		nand_send_address(0, page + ppb + offset);
+		writeb(NAND_CMD_READSTART, nand_regs + NAND_CMD);
+		nand_wait_intpend();
+
+		writeb(NAND_CMD_MULTI_RNDOUT, nand_regs + NAND_CMD);
+		nand_send_address(0, page + offset);
+		writeb(NAND_CMD_RNDOUTSTART, nand_regs + NAND_CMD);
+		nand_read_buf(mem, nand_chip->read_size);
+
+		writeb(NAND_CMD_MULTI_RNDOUT, nand_regs + NAND_CMD);
+		nand_send_address(0, page + ppb + offset);
+		writeb(NAND_CMD_RNDOUTSTART, nand_regs + NAND_CMD);
+		nand_read_buf(mem2, nand_chip->read_size);
+
+		mem += nand_chip->read_size;
+		mem2 += nand_chip->read_size;
+	}
+
+	return 0;
+}
+
+/* multi-page reads and programs pipeline through the cache register */
+static inline bool nand_op_cached(struct nand_op *op)
+{
+	if (op->count < 2)
+		return false;
+
+	switch (op->type) {
+	case NAND_OP_READ:
+		return nand_chip->cache_read;
+	case NAND_OP_PROGRAM:
+		return nand_chip->cache_prog;
+	default:
+		return false;
+	}
+}
+
+/* moves the next page to the cache register and starts loading another */
+static void nand_op_cache_next(struct nand_op *op)
+{
+	/* as nand_count, 3Fh loads no page */
+	if (op->done + 1 == op->count) {
+		writeb(NAND_CMD_READ_CACHE_END, nand_regs + NAND_CMD);
+	} else {
+		nand_chip->stats.pages_read++;
+		writeb(NAND_CMD_READ_CACHE, nand_regs + NAND_CMD);
+	}
+	op->state = NAND_OP_CACHE;
+	op->busy_since = trace_time();
+}
+
+static inline void nand_op_advance(struct nand_op *op)
+{
+	if (op->type == NAND_OP_ERASE) {
+		op->page += nand_chip->pages_per_block;
+	} else if (op->oob) {
+		op->page++;
+		op->buf += nand_chip->info.page_size;
+		op->oob += nand_chip->info.oob_size;
+	} else {
+		op->page++;
+		op->buf += nand_chip->read_size;
+	}
+}
+
+/* whether a program has another page after this one that isn't erased */
+static bool nand_op_more(struct nand_op *op)
+{
+	void *mem = op->buf;
+	int i;
+
+	for (i = op->done + 1; i < op->count; i++) {
 		mem += nand_chip->read_size;
+		if (!nand_page_erased(mem, nand_chip->read_size))
+			return true;
+	}
+
+	return false;
+}
+
+/* issues the next page (or block) of an operation without waiting */
+static int nand_op_issue(struct nand_op *op)
+{
+	int block = op->page / nand_chip->pages_per_block;
+
+	if (op->type != NAND_OP_READ && nand_block_is_bad(block))
+		return -1;
+
+	/* the erase already left all-0xFF pages that way */
+	if (op->type == NAND_OP_PROGRAM) {
+		while (nand_page_erased(op->buf, nand_chip->read_size)) {
+			if (++op->done == op->count)
+				return 0;
+			nand_op_advance(op);
+		}
+	}
+
+	switch (op->type) {
+	case NAND_OP_READ:
+		nand_send_command(NAND_CMD_READ0, 0, op->page);
+		break;
+
+	case NAND_OP_PROGRAM:
+		if (nand_op_cached(op) && nand_op_more(op))
+			op->state = NAND_OP_CACHE;
+		nand_send_command(NAND_CMD_SEQIN, 0, op->page);
+		if (nand_write_data(op->buf, nand_chip->read_size))
+			return -ETIMEDOUT;
+		nand_send_command((op->state == NAND_OP_CACHE) ?
+				NAND_CMD_CACHEDPROG : NAND_CMD_PAGEPROG, -1, -1);
+		break;
+
+	case NAND_OP_ERASE:
+		nand_send_command(NAND_CMD_ERASE1, -1, op->page);
+		nand_send_command(NAND_CMD_ERASE2, -1, -1);
+		break;
+	}
+
+	op->busy_since = trace_time();
+	return -EINPROGRESS;
+}
+
+/*
+ * Polls the selected chip with READ STATUS, which unlike R/B is per
+ * chip, and finishes the current page once it is ready.  Returns -EBUSY
+ * while the chip is busy and -EINPROGRESS when more pages remain.
+ */
+static int nand_op_poll(struct nand_op *op)
+{
+	int status;
+
+	writeb(NAND_CMD_STATUS, nand_regs + NAND_CMD);
+	status = readb(nand_regs + NAND_DATA);
+	if (!(status & NAND_STATUS_READY))
+		return -EBUSY;
+
+	/* busy time of queued ops, as nand_wait_done for blocking ones */
+	nand_chip->stats.wait_ticks += trace_time() - op->busy_since;
+
+	if (op->type == NAND_OP_READ) {
+		/* back to data output after the status read */
+		writeb(NAND_CMD_READ0, nand_regs + NAND_CMD);
+		if (nand_op_cached(op) && op->state == NAND_OP_BUSY) {
+			nand_op_cache_next(op);
+			return -EBUSY;
+		}
+		if (op->oob)
+			nand_read_buf_split(op->buf, op->oob);
+		else
+			nand_read_buf(op->buf, nand_chip->read_size);
+		status = 0;
+	} else if (op->piped >= 0 && (status & NAND_STATUS_FAIL_N1)) {
+		/* the page started with 15h before this one */
+		nand_chip->stats.errors++;
+		iprintf("error programming page %d\n", op->piped);
+		return status | NAND_STATUS_FAIL;
+	} else if (op->state != NAND_OP_CACHE &&
+			(status & NAND_STATUS_FAIL)) {
+		nand_chip->stats.errors++;
+		iprintf("error %s page %d\n", (op->type == NAND_OP_ERASE) ?
+				"erasing" : "programming", op->page);
+		return status;
+	}
+
+	if (op->type == NAND_OP_PROGRAM)
+		op->piped = (op->state == NAND_OP_CACHE) ? op->page : -1;
+
+	if (++op->done == op->count)
+		return status;
+
+	nand_op_advance(op);
+
+	if (op->type == NAND_OP_READ && op->state == NAND_OP_CACHE) {
+		nand_op_cache_next(op);
+		return -EBUSY;
 	}
-	
+
+	return -EINPROGRESS;
+}
+
+int nand_submit(struct nand_op *op)
+{
+	struct nand_chip *chip;
+
+	if (!op || op->chip >= NAND_MAX_CHIPS || op->count <= 0 ||
+			!list_empty(&op->queue))
+		return -EINVAL;
+
+	chip = &nand_chips[op->chip];
+	if (!chip->info.known)
+		return -ENODEV;
+
+	op->state = NAND_OP_ISSUE;
+	op->done = 0;
+	op->piped = -1;
+	op->status = -EINPROGRESS;
+	list_add_tail(&op->queue, &nand_queue[op->chip]);
+
+	event_post(&nand_event);
 	return 0;
 }
 
+bool nand_idle(void)
+{
+	int chipnr;
+
+	for (chipnr = 0; chipnr < NAND_MAX_CHIPS; chipnr++)
+		if (!list_empty(&nand_queue[chipnr]))
+			return false;
+
+	return true;
+}
+
+/*
+ * Advances the head operation of every chip by one step, so one chip
+ * can transfer data while the other is busy.
+ */
+void nand_task(void)
+{
+	struct nand_chip *selected = nand_chip;
+	struct nand_op *op;
+	int chipnr, status;
+
+	for (chipnr = 0; chipnr < NAND_MAX_CHIPS; chipnr++) {
+		if (list_empty(&nand_queue[chipnr]))
+			continue;
+
+		op = list_entry(nand_queue[chipnr].next,
+				struct nand_op, queue);
+		nand_select_chip(chipnr);
+
+		if (op->state == NAND_OP_ISSUE) {
+			status = nand_op_issue(op);
+			if (op->state == NAND_OP_ISSUE)
+				op->state = NAND_OP_BUSY;
+		} else {
+			/* -EBUSY: poll again, nand_op_poll keeps the state */
+			status = nand_op_poll(op);
+			if (status == -EBUSY)
+				continue;
+			op->state = NAND_OP_ISSUE;
+		}
+
+		if (status == -EINPROGRESS)
+			continue;
+
+		list_del_init(&op->queue);
+		op->status = status;
+		if (op->complete)
+			op->complete(op);
+	}
+
+	nand_select_chip(selected ? selected->num : -1);
+
+	/*
+	 * Queued ops are polled with READ STATUS, not woken by the MCUS
+	 * interrupt (that only ends the blocking waits), so come straight
+	 * back while any are left.
+	 */
+	if (!nand_idle())
+		event_post(&nand_event);
+}
+
+static void nand_task_event(void *arg)
+{
+	nand_task();
+}
+
+void nand_init(void)
+{
+	u32 ctrl;
+	int chipnr;
+
+	bch_init();
+
+	nand_clear_intpend();
+	ctrl = readl(mcus_regs + MCUS_NFCONTROL) & ~MCUS_NFCONTROL_INTPEND;
+	writel(ctrl | MCUS_NFCONTROL_IRQENB, mcus_regs + MCUS_NFCONTROL);
+	irq_request(IRQ_MCUS, nand_irq);
+
+	for (chipnr = 0; chipnr < NAND_MAX_CHIPS; chipnr++) {
+		nand_select_chip(chipnr);
+		nand_chip->num = chipnr;
+
+		nand_identify();
+		if (nand_chip->info.known) {
+			nand_command(NAND_CMD_RESET, -1, -1);
+
+			/*
+			 * Without a table the scan stays in RAM.  Only nand
+			 * savebbt writes one, as that erases the last blocks.
+			 */
+			if (nand_bbt_load() < 0)
+				nand_scan_bad();
+		}
+	}
+	nand_select_chip(-1);
+}
@@ -21,9 +21,30 @@
 #include <stdbool.h>
 
 #include "asm/types.h"
+#include "linux/list.h"
 
 #define NAND_MAX_CHIPS (2)
 #define NAND_MAX_BLOCKS (4096)
+#define NAND_MAX_BLOCK_PAGES (256)
+
+/* 2-bit bad block table entries */
+#define NAND_BBT_GOOD		(0)
+#define NAND_BBT_WORN		(1) /* went bad in use */
+#define NAND_BBT_RESERVED	(2) /* holds the on-flash table */
+#define NAND_BBT_FACTORY	(3)
+
+/* the on-flash table and its mirror live in the last blocks */
+#define NAND_BBT_BLOCKS		(4)
+
+/* where the 7 ECC bytes of each 512 byte step go in the OOB */
+enum nand_ecc_mode {
+	NAND_ECC_NONE = 0,
+	NAND_ECC_TAIL,	/* packed at the end of the OOB */
+	NAND_ECC_HEAD,	/* right after the bad block marker */
+};
+
+/* nand_chip.ecc_report entry of a page that could not be corrected */
+#define NAND_ECC_FAILED (0xFF)
 
 struct nand_info {
 	bool present;
@@ -37,6 +58,15 @@ struct nand_info {
 	u16 chip_size;  /* MiB */
 };
 
+/* counted on the chip selected when the command is issued */
+struct nand_stats {
+	u32 pages_read;
+	u32 pages_programmed;
+	u32 blocks_erased;
+	u32 wait_ticks;	/* chip busy in blocking waits and ops, trace_hz() */
+	u32 errors;	/* program and erase failures */
+};
+
 struct nand_chip {
 	u8 num;
 	struct nand_info info;
@@ -46,18 +76,75 @@ struct nand_chip {
 	u16 num_blocks;
 	u16 pages_per_block;
 	u16 read_size;  /* B */
+	bool cache_read;
+	bool cache_prog;
+	u8 ecc_mode;
+	u8 ecc_algo;
+	u8 ecc_report[NAND_MAX_BLOCK_PAGES]; /* bits corrected, last block */
+	u32 ecc_corrected;
+	u32 ecc_failed;
+	u32 bbt_version;
+	struct nand_stats stats;
 	u8 bbt[NAND_MAX_BLOCKS / 4];
 };
 
+struct nand_mismatch {
+	u32 page;
+	u32 bits;	/* bits that differ, data and OOB */
+};
+
+enum nand_op_type {
+	NAND_OP_READ = 0,
+	NAND_OP_PROGRAM,
+	NAND_OP_ERASE,
+};
+
+/*
+ * An asynchronous operation on `count` pages (or blocks, for erase)
+ * starting at `page`, queued with nand_submit() and advanced by
+ * nand_task().  `status` is -EINPROGRESS until complete() is called,
+ * then 0 or the NAND status for reads and programs, the NAND status for
+ * erases, or -1 for a bad block.  Reads are always raw, ECC is never
+ * checked or corrected; programs generate parity like nand_write_page.
+ */
+struct nand_op {
+	enum nand_op_type	type;
+	u8			chip;
+	u8			state;
+	int			page;
+	int			count;
+	int			done;
+	int			piped;	/* 15h page awaiting status */
+	u32			busy_since;	/* trace_time() */
+	void			*buf;
+	void			*oob;	/* reads only: OOB apart from buf */
+	int			status;
+	void			(*complete)(struct nand_op *op);
+	struct list_head	queue;
+};
+
 extern struct nand_chip *nand_chip;
 
 void nand_init(void);
 void nand_select_chip(int chipnr);
+struct nand_chip *nand_get_chip(int chipnr);
 int nand_erase_block(int block);
-void nand_read_page(int page, void *mem, int size);
+int nand_set_ecc(int mode, int algo);
+int nand_read_page(int page, void *mem, int size);
 int nand_write_page(int page, void *mem, int size);
-void nand_read_block(int block, void *mem);
+int nand_read_block(int block, void *mem);
 int nand_write_block(int block, void *mem);
+int nand_erase_block_pair(int block);
+int nand_read_block_pair(int block, void *mem);
+int nand_write_block_pair(int block, void *mem);
+int nand_compare_pages(int page, int count, const void *mem,
+		const void *read, struct nand_mismatch *list);
+int nand_verify_block(int block, const void *mem, struct nand_mismatch *list);
+bool nand_page_erased(const void *mem, int size);
+int nand_bbt_save(void);
+int nand_submit(struct nand_op *op);
+void nand_task(void);
+bool nand_idle(void);
 
 #endif /* _NAND_H */
 
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdbool.h>
+
+#include "asm/io.h"
+#include "asm/types.h"
+
+#include "irq.h"
+#include "trace.h"
+
+/* Pollux timer 1, free running off PLL1 */
+#define TIMER_BASE		(0xC0001880)
+
+#define TIMER_COUNT		(0x00)
+#define TIMER_MATCH		(0x04)
+#define TIMER_CONTROL		(0x08)
+#define TIMER_CLKENB		(0x40)
+#define TIMER_CLKGEN		(0x44)
+
+#define TIMER_CONTROL_INTPEND	(1 << 5)
+#define TIMER_CONTROL_RUN	(1 << 3)
+#define TIMER_CONTROL_SETCLK_1	(3 << 0) /* TCLK undivided */
+
+#define TIMER_CLKENB_CLKGENENB	(1 << 2)
+#define TIMER_CLKENB_PCLKMODE	(1 << 3)
+
+#define TIMER_CLKGEN_CLKDIV(x)	(((x) - 1) << 4)
+#define TIMER_CLKGEN_CLKSRC_PLL1 (1 << 1)
+
+#define TRACE_PLL1_HZ		(147456000)
+#define TRACE_CLKDIV		(16)
+
+static void __iomem *timer_regs = (void __iomem *) TIMER_BASE;
+
+#if TRACE_ENABLE
+static struct trace_entry trace_ring[TRACE_LEN];
+static u32 trace_head;
+static bool trace_wrapped;
+static bool trace_paused;
+#endif
+
+void trace_init(void)
+{
+	writel(TIMER_CLKENB_PCLKMODE, timer_regs + TIMER_CLKENB);
+	writel(TIMER_CLKGEN_CLKSRC_PLL1 | TIMER_CLKGEN_CLKDIV(TRACE_CLKDIV),
+			timer_regs + TIMER_CLKGEN);
+	writel(TIMER_CLKENB_PCLKMODE | TIMER_CLKENB_CLKGENENB,
+			timer_regs + TIMER_CLKENB);
+
+	/* never matches in practice, so it counts through the whole range */
+	writel(0, timer_regs + TIMER_COUNT);
+	writel(0xFFFFFFFF, timer_regs + TIMER_MATCH);
+	writel(TIMER_CONTROL_INTPEND | TIMER_CONTROL_RUN |
+			TIMER_CONTROL_SETCLK_1, timer_regs + TIMER_CONTROL);
+}
+
+u32 trace_hz(void)
+{
+	return TRACE_PLL1_HZ / TRACE_CLKDIV;
+}
+
+/* ticks of trace_hz(), wrapping every 2^32 ticks (about 466 s) */
+u32 trace_time(void)
+{
+	return readl(timer_regs + TIMER_COUNT);
+}
+
+#if TRACE_ENABLE
+/* called from interrupt and task context alike */
+void trace(int event, u32 arg)
+{
+	struct trace_entry *e;
+	u32 flags;
+
+	flags = irq_save();
+	if (trace_paused) {
+		irq_restore(flags);
+		return;
+	}
+
+	e = &trace_ring[trace_head];
+	e->time = readl(timer_regs + TIMER_COUNT);
+	e->event = event;
+	e->arg = arg;
+	trace_head = (trace_head + 1) & (TRACE_LEN - 1);
+	if (!trace_head)
+		trace_wrapped = true;
+	irq_restore(flags);
+}
+
+/*
+ * Copies the ring out oldest first and empties it.  Only the indices
+ * are taken with IRQs masked; recording pauses for the 32 KB copy, so
+ * the UDC keeps being serviced and events meanwhile are dropped.
+ */
+int trace_snapshot(struct trace_entry *buf)
+{
+	u32 flags;
+	int count, first, i;
+
+	flags = irq_save();
+	trace_paused = true;
+	count = trace_wrapped ? TRACE_LEN : trace_head;
+	first = trace_wrapped ? trace_head : 0;
+	irq_restore(flags);
+
+	for (i = 0; i < count; i++)
+		buf[i] = trace_ring[(first + i) & (TRACE_LEN - 1)];
+
+	flags = irq_save();
+	trace_head = 0;
+	trace_wrapped = false;
+	trace_paused = false;
+	irq_restore(flags);
+
+	return count;
+}
+#else
+int trace_snapshot(struct trace_entry *buf)
+{
+	return 0;
+}
+#endif
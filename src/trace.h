@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "asm/types.h"
+
+/*
+ * Each event costs an irq_save and a timer read on a hot path, and the
+ * timer 1 setup is unverified, so recording is only built in with
+ * -DTRACE_ENABLE=1.  trace_time() is there either way for the stats.
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE	(0)
+#endif
+
+#define TRACE_LEN	(4096) /* entries, a power of two */
+
+enum trace_event {
+	TRACE_UDC_TASK = 0,	/* arg: 0 */
+	TRACE_REQ_QUEUE,	/* arg: endpoint address */
+	TRACE_REQ_COMPLETE,	/* arg: endpoint address */
+	TRACE_NAND_CMD,		/* arg: command byte */
+	TRACE_NAND_WAIT,	/* arg: 0 for R/B, 1 for the interrupt */
+	TRACE_NAND_READY,	/* arg: as TRACE_NAND_WAIT */
+	TRACE_CMD_PARSE,	/* arg: opcode */
+	NUM_TRACE_EVENTS,
+};
+
+struct trace_entry {
+	u32 time;	/* ticks of trace_header.hz */
+	u16 event;
+	u16 arg;
+};
+
+/* what trace dump sends, followed by TRACE_LEN entries, oldest first */
+struct trace_header {
+	u32 hz;
+	u32 count;	/* entries that are valid */
+};
+
+void trace_init(void);
+#if TRACE_ENABLE
+void trace(int event, u32 arg);
+#else
+static inline void trace(int event, u32 arg) { }
+#endif
+int trace_snapshot(struct trace_entry *buf);
+u32 trace_hz(void);
+u32 trace_time(void);
+
+#endif /* _TRACE_H */
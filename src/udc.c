@@ -27,11 +27,47 @@
 #include "linux/list.h"
 #include "linux/usb/ch9.h"
 
+#include "dma.h"
+#include "event.h"
+#include "irq.h"
+#include "trace.h"
 #include "udc.h"
 
 #define ESHUTDOWN 108
 
+/*
+ * Endpoints that may use DMA, everything else is PIO only.  The DMA
+ * channel and UDC DMA register layouts haven't been checked on hardware
+ * yet, so all endpoints default to PIO; build with
+ * -DUDC_DMA_EPS=0x6 to try DMA on EP1 and EP2.
+ */
+#ifndef UDC_DMA_EPS
+#define UDC_DMA_EPS		(0)
+#endif
+
+/* DMA interface registers */
+#ifndef UDC_DCR
+#define UDC_DCR			(0x30)
+#define UDC_DTCR		(0x32)
+#define UDC_DFCR		(0x34)
+#define UDC_DTTCR1		(0x36)
+#define UDC_DTTCR2		(0x38)
+#endif
+
+#define UDC_DCR_DEN		(1 << 0)
+#define UDC_DCR_RDR		(1 << 1)
+#define UDC_DCR_TDR		(1 << 2)
+#define UDC_DCR_DMDE		(1 << 3)
+
 static struct udc _udc;
+static struct udc_req udc_req_pool[NUM_ENDPOINTS][UDC_REQ_POOL];
+
+static void udc_task_event(void *arg);
+
+static struct event udc_event = {
+	.fn = udc_task_event,
+	.arg = &_udc,
+};
 
 #define ep_index(_ep)		((_ep)->address & USB_ENDPOINT_NUMBER_MASK)
 #define ep_is_in(_ep)		((_ep)->address & USB_DIR_IN)
@@ -42,6 +78,102 @@ static inline void set_index(struct udc *udc, int addr)
 	writew(addr, udc->regs + UDC_IR);
 }
 
+/* packets held in the dual FIFO of the indexed endpoint */
+static inline int udc_fifo_packets(struct udc *udc)
+{
+	return (readw(udc->regs + UDC_ESR) >> 2) & 3;
+}
+
+/* where the next byte of a request goes, and what is left of its segment */
+static inline void *udc_req_pos(struct udc_req *req, u32 *left)
+{
+	struct udc_sg *sg;
+
+	if (!req->sg) {
+		*left = req->length - req->actual;
+		return req->buf + req->actual;
+	}
+
+	sg = &req->sg[req->sg_index];
+	*left = sg->length - req->sg_offset;
+	return sg->buf + req->sg_offset;
+}
+
+static void udc_req_advance(struct udc_req *req, u32 bytes)
+{
+	req->actual += bytes;
+	if (!req->sg)
+		return;
+
+	req->sg_offset += bytes;
+	while (req->sg_index < req->num_sgs - 1 &&
+			req->sg_offset >= req->sg[req->sg_index].length) {
+		req->sg_offset -= req->sg[req->sg_index].length;
+		req->sg_index++;
+	}
+}
+
+/*
+ * The FIFO port only takes 16-bit accesses.  From a word aligned buffer
+ * memory is moved four words at a time, which gcc turns into ldm/stm,
+ * and the halves go to the port without a branch per halfword.
+ */
+static inline void udc_fifo_out(void __iomem *fifo, const u16 *buf, u32 n)
+{
+	const u32 *p;
+	u32 a, b, c, d;
+
+	if (!((u32)buf & 3)) {
+		p = (const u32 *)buf;
+		for (; n >= 8; n -= 8) {
+			a = *p++;
+			b = *p++;
+			c = *p++;
+			d = *p++;
+			writew(a, fifo);
+			writew(a >> 16, fifo);
+			writew(b, fifo);
+			writew(b >> 16, fifo);
+			writew(c, fifo);
+			writew(c >> 16, fifo);
+			writew(d, fifo);
+			writew(d >> 16, fifo);
+		}
+		buf = (const u16 *)p;
+	}
+
+	while (n--)
+		writew(*buf++, fifo);
+}
+
+static inline void udc_fifo_in(void __iomem *fifo, u16 *buf, u32 n)
+{
+	u32 *p;
+	u32 a, b, c, d;
+
+	if (!((u32)buf & 3)) {
+		p = (u32 *)buf;
+		for (; n >= 8; n -= 8) {
+			a = readw(fifo);
+			a |= (u32)readw(fifo) << 16;
+			b = readw(fifo);
+			b |= (u32)readw(fifo) << 16;
+			c = readw(fifo);
+			c |= (u32)readw(fifo) << 16;
+			d = readw(fifo);
+			d |= (u32)readw(fifo) << 16;
+			*p++ = a;
+			*p++ = b;
+			*p++ = c;
+			*p++ = d;
+		}
+		buf = (u16 *)p;
+	}
+
+	while (n--)
+		*buf++ = readw(fifo);
+}
+
 static void udc_complete_req(struct udc_ep *ep,
 		struct udc_req *req, int status)
 {
@@ -49,6 +181,9 @@ static void udc_complete_req(struct udc_ep *ep,
 
 	list_del_init(&req->queue);
 	req->status = status;
+	trace(TRACE_REQ_COMPLETE, ep->address);
+	if (status)
+		ep->stats.errors++;
 
 	if (!ep_index(ep)) {
 		udc->ep0_state = WAIT_FOR_SETUP;
@@ -94,17 +229,23 @@ static int udc_write_fifo(struct udc_ep *ep, struct udc_req *req)
 	void __iomem *fifo = ep->fifo;
 	u16 *buf;
 	u32 max = ep->maxpacket;
-	u32 count, length;
+	u32 count, length, left, n;
 	bool is_last;
 
-	buf = req->buf + req->actual;
 	length = req->length - req->actual;
 	length = min(length, max);
-	req->actual += length;
 
+	/* a packet may span the end of one segment and the start of the next */
 	writew(length, udc->regs + UDC_BWCR);
-	for (count = 0; count < length; count += 2)
-		writew(*buf++, fifo);
+	for (count = 0; count < length; count += n) {
+		buf = udc_req_pos(req, &left);
+		n = min(left, length - count);
+		udc_fifo_out(fifo, buf, (n + 1) / 2);
+		udc_req_advance(req, n);
+	}
+
+	ep->stats.packets++;
+	ep->stats.bytes += length;
 
 	if (length != max) {
 		is_last = true;
@@ -125,9 +266,9 @@ static int udc_read_fifo(struct udc_ep *ep, struct udc_req *req)
 {
 	struct udc *udc = ep->dev;
 	void __iomem *fifo = ep->fifo;
-	u16 *buf, word;
+	u16 *buf;
 	int buflen, count, length, bytes;
-	u32 offset;
+	u32 offset, left, done, n;
 	u16 esr;
 	int is_last = 0;
 
@@ -136,7 +277,6 @@ static int udc_read_fifo(struct udc_ep *ep, struct udc_req *req)
 	if (!(esr & UDC_ESR_RX_SUCCESS))
 		return -EINVAL;
 
-	buf = req->buf + req->actual;
 	buflen = req->length - req->actual;
 
 	count = readw(udc->regs + UDC_BRCR);
@@ -146,17 +286,22 @@ static int udc_read_fifo(struct udc_ep *ep, struct udc_req *req)
 
 	bytes = min(length, buflen);
 
-	req->actual += bytes;
+	ep->stats.packets++;
+	ep->stats.bytes += bytes;
 	is_last = (length < ep->maxpacket);
 
-	while (count--) {
-		word = readw(fifo);
-		if (buflen) {
-			*buf++ = word;
-			buflen -= 2;
-		} else {
-			req->status = -EOVERFLOW;
-		}
+	for (done = 0; done < bytes; done += n) {
+		buf = udc_req_pos(req, &left);
+		n = min(left, bytes - done);
+		udc_fifo_in(fifo, buf, (n + 1) / 2);
+		count -= (n + 1) / 2;
+		udc_req_advance(req, n);
+	}
+
+	/* whatever the request has no room for */
+	for (; count > 0; count--) {
+		readw(fifo);
+		req->status = -EOVERFLOW;
 	}
 
 	if (!ep_index(ep)) {
@@ -174,9 +319,187 @@ static int udc_read_fifo(struct udc_ep *ep, struct udc_req *req)
 	return is_last;
 }
 
-static inline void udc_epin_intr(struct udc *udc, struct udc_ep *ep)
+static bool udc_start_dma(struct udc_ep *ep, struct udc_req *req);
+
+/* keeps both halves of an IN endpoint's FIFO loaded */
+static void udc_fill_fifo(struct udc_ep *ep)
 {
 	struct udc_req *req;
+	int n;
+
+	for (n = udc_fifo_packets(ep->dev); n < 2; n++) {
+		if (list_empty(&ep->queue) || ep->stopped || ep->dma_length)
+			break;
+
+		req = list_entry(ep->queue.next, struct udc_req, queue);
+
+		/*
+		 * A request queued behind another starts on DMA here, and
+		 * one with segments goes back to DMA once past a packet
+		 * that spans two of them.
+		 */
+		if ((!req->actual || req->sg) && udc_start_dma(ep, req))
+			break;
+
+		udc_write_fifo(ep, req);
+	}
+}
+
+/* empties every packet waiting in an OUT endpoint's FIFO */
+static void udc_drain_fifo(struct udc_ep *ep)
+{
+	struct udc_req *req;
+	int n;
+
+	for (n = udc_fifo_packets(ep->dev); n > 0; n--) {
+		if (list_empty(&ep->queue) || ep->stopped || ep->dma_length)
+			break;
+
+		req = list_entry(ep->queue.next, struct udc_req, queue);
+		if ((!req->actual || req->sg) && udc_start_dma(ep, req))
+			break;
+
+		if (udc_read_fifo(ep, req) < 0)
+			break;
+	}
+}
+
+/*
+ * Moves the whole-packet part of a request, the tail is left to PIO.
+ * No cache maintenance is needed: the MMU is never enabled, so the
+ * ARM926 D-cache stays off and request buffers are uncached.
+ */
+static bool udc_start_dma(struct udc_ep *ep, struct udc_req *req)
+{
+	struct udc *udc = ep->dev;
+	u8 reqid = DMA_REQID_UDC_EP1 + ep_index(ep) - 1;
+	void *buf;
+	u32 length;
+	u16 dcr;
+
+	/* never past the end of the current segment */
+	buf = udc_req_pos(req, &length);
+	if (ep->dma_ch < 0 || ((u32)buf & 1))
+		return false;
+
+	length = min(length, (u32)DMA_MAX_LENGTH);
+	length -= length % ep->maxpacket;
+	if (!length)
+		return false;
+
+	set_index(udc, ep->address);
+	writew(ep->maxpacket, udc->regs + UDC_DTCR);
+	writew(length & 0xFFFF, udc->regs + UDC_DTTCR1);
+	writew(length >> 16, udc->regs + UDC_DTTCR2);
+
+	ep->dma_length = length;
+	if (ep_is_in(ep)) {
+		writew(ep->maxpacket, udc->regs + UDC_BWCR);
+		dma_to_io(ep->dma_ch, buf, ep->fifo, length, reqid);
+		dcr = UDC_DCR_TDR;
+	} else {
+		dma_from_io(ep->dma_ch, ep->fifo, buf, length, reqid);
+		dcr = UDC_DCR_RDR;
+	}
+	writew(UDC_DCR_DEN | UDC_DCR_DMDE | dcr, udc->regs + UDC_DCR);
+
+	return true;
+}
+
+static void udc_stop_dma(struct udc_ep *ep)
+{
+	struct udc *udc = ep->dev;
+
+	if (!ep->dma_length)
+		return;
+
+	dma_stop(ep->dma_ch);
+	ep->dma_length = 0;
+
+	set_index(udc, ep->address);
+	writew(0, udc->regs + UDC_DCR);
+}
+
+/*
+ * Starts the request queued behind one that just finished on DMA, so
+ * the endpoint doesn't sit idle until its next interrupt.
+ */
+static void udc_start_next(struct udc_ep *ep)
+{
+	struct udc_req *req;
+
+	if (list_empty(&ep->queue) || ep->stopped || ep->dma_length)
+		return;
+
+	/* an OUT request may start before its first packet arrives */
+	req = list_entry(ep->queue.next, struct udc_req, queue);
+	if (!req->actual && udc_start_dma(ep, req))
+		return;
+
+	if (ep_is_in(ep))
+		udc_fill_fifo(ep);
+	else
+		udc_drain_fifo(ep);
+}
+
+static void udc_dma_done(struct udc_ep *ep, u32 residue, bool short_rx)
+{
+	struct udc *udc = ep->dev;
+	struct udc_req *req;
+
+	set_index(udc, ep->address);
+	writew(0, udc->regs + UDC_DCR);
+
+	req = list_entry(ep->queue.next, struct udc_req, queue);
+	udc_req_advance(req, ep->dma_length - residue);
+	ep->stats.packets += (ep->dma_length - residue) / ep->maxpacket;
+	ep->stats.bytes += ep->dma_length - residue;
+	ep->dma_length = 0;
+
+	if (req->actual == req->length && !(ep_is_in(ep) && req->zero)) {
+		udc_complete_req(ep, req, 0);
+		udc_start_next(ep);
+		return;
+	}
+
+	/*
+	 * A short packet stopped an OUT transfer early.  It and anything
+	 * the channel hadn't reached yet are still in the FIFO; take them
+	 * by PIO, which completes the request, rather than re-arming DMA
+	 * for bytes that will never come.
+	 */
+	if (short_rx) {
+		while (udc_fifo_packets(udc) > 0)
+			if (udc_read_fifo(ep, req) != 0)
+				break;
+		udc_start_next(ep);
+		return;
+	}
+
+	if (udc_start_dma(ep, req))
+		return;
+
+	/* short tail or zero length packet */
+	if (ep_is_in(ep))
+		udc_fill_fifo(ep);
+	else
+		udc_drain_fifo(ep);
+}
+
+static void udc_dma_task(struct udc *udc)
+{
+	struct udc_ep *ep;
+	int epnum;
+
+	for (epnum = 1; epnum < NUM_ENDPOINTS; epnum++) {
+		ep = &udc->ep[epnum];
+		if (ep->dma_length && !dma_busy(ep->dma_ch))
+			udc_dma_done(ep, 0, false);
+	}
+}
+
+static inline void udc_epin_intr(struct udc *udc, struct udc_ep *ep)
+{
 	u16 esr;
 
 	esr = readw(udc->regs + UDC_ESR);
@@ -187,19 +510,18 @@ static inline void udc_epin_intr(struct udc *udc, struct udc_ep *ep)
 
 	if (esr & UDC_ESR_TX_SUCCESS) {
 		writew(UDC_ESR_TX_SUCCESS, udc->regs + UDC_ESR);
-		if (list_empty(&ep->queue))
+		if (list_empty(&ep->queue) || ep->dma_length)
 			return;
 
-		req = list_entry(ep->queue.next,
-				struct udc_req, queue);
-		if (!udc_write_fifo(ep, req) && (esr & UDC_ESR_PSIF_TWO))
-			udc_write_fifo(ep, req);
+		if (!udc_fifo_packets(udc))
+			ep->stats.fifo_empty++;
+
+		udc_fill_fifo(ep);
 	}
 }
 
 static inline void udc_epout_intr(struct udc *udc, struct udc_ep *ep)
 {
-	struct udc_req *req;
 	u16 esr;
 	u16 ecr;
 
@@ -219,11 +541,18 @@ static inline void udc_epout_intr(struct udc *udc, struct udc_ep *ep)
 		if (list_empty(&ep->queue))
 			return;
 
-		req = list_entry(ep->queue.next,
-				struct udc_req, queue);
-		if (!udc_read_fifo(ep, req) && (esr & UDC_ESR_PSIF_TWO))
-			udc_read_fifo(ep, req);
-	}	
+		/* a short packet ends the DMA transfer early */
+		if (ep->dma_length) {
+			if (readw(udc->regs + UDC_BRCR) * 2 < ep->maxpacket)
+				udc_dma_done(ep, dma_stop(ep->dma_ch), true);
+			return;
+		}
+
+		if (udc_fifo_packets(udc) == 2)
+			ep->stats.fifo_full++;
+
+		udc_drain_fifo(ep);
+	}
 }
 
 static int udc_set_halt(struct udc_ep *ep, bool halt)
@@ -251,7 +580,8 @@ static int udc_set_halt(struct udc_ep *ep, bool halt)
 	}
 	writew(ecr, udc->regs + offset);
 
-	if (ep_is_in(ep) && !list_empty(&ep->queue) && !halt) {
+	if (ep_is_in(ep) && !list_empty(&ep->queue) && !halt &&
+			!ep->dma_length) {
 		req = list_entry(ep->queue.next,
 			struct udc_req, queue);
 		if (req)
@@ -491,24 +821,46 @@ static int udc_disable_ep(struct udc_ep *ep)
 	eier &= ~ep_index(ep);
 	writew(eier, udc->regs + UDC_EIER);
 
+	udc_stop_dma(ep);
 	udc_nuke_ep(ep, -ESHUTDOWN);
 	ep->stopped = 1;
 
 	return 0;
 }
 
+/*
+ * Requests come from a static pool per endpoint, kept as a stack of
+ * free entries, so alloc and free take constant time from any context.
+ */
 static void udc_free_req(struct udc_ep *ep, struct udc_req *req)
 {
-	free(req);
+	struct udc_req *pool = udc_req_pool[ep_index(ep)];
+	u32 flags;
+
+	if (req < pool || req >= pool + UDC_REQ_POOL)
+		return;
+
+	flags = irq_save();
+	ep->req_free[ep->req_nfree++] = req;
+	ep->stats.reqs--;
+	irq_restore(flags);
 }
 
 static struct udc_req *udc_alloc_req(struct udc_ep *ep)
 {
 	struct udc_req *req;
+	u32 flags;
 
-	req = malloc(sizeof(*req));
-	if (!req)
+	flags = irq_save();
+	if (!ep->req_nfree) {
+		irq_restore(flags);
 		return NULL;
+	}
+
+	req = ep->req_free[--ep->req_nfree];
+	if (++ep->stats.reqs > ep->stats.reqs_max)
+		ep->stats.reqs_max = ep->stats.reqs;
+	irq_restore(flags);
 
 	bzero(req, sizeof(*req));
 
@@ -518,11 +870,25 @@ static struct udc_req *udc_alloc_req(struct udc_ep *ep)
 	return req;
 }
 
-static int udc_queue(struct udc_ep *ep, struct udc_req *req)
+static int __udc_queue(struct udc_ep *ep, struct udc_req *req)
 {
 	struct udc *udc;
 	u32 offset;
 	u16 esr;
+	int i;
+
+	if (req && req->sg) {
+		if (req->num_sgs <= 0)
+			return -EINVAL;
+
+		req->buf = req->sg[0].buf;
+		req->length = 0;
+		for (i = 0; i < req->num_sgs; i++)
+			req->length += req->sg[i].length;
+		req->sg_index = 0;
+		req->sg_offset = 0;
+		udc_req_advance(req, 0);
+	}
 
 	if (!ep || !req || !req->buf ||	!list_empty(&req->queue))
 		return -EINVAL;
@@ -532,6 +898,7 @@ static int udc_queue(struct udc_ep *ep, struct udc_req *req)
 		return -ESHUTDOWN;
 
 	set_index(udc, ep->address);
+	trace(TRACE_REQ_QUEUE, ep->address);
 
 	req->status = -EINPROGRESS;
 	req->actual = 0;
@@ -543,6 +910,22 @@ static int udc_queue(struct udc_ep *ep, struct udc_req *req)
 		return 0;
 	}
 
+	if (ep_index(ep)) {
+		list_add_tail(&req->queue, &ep->queue);
+		if (ep->queue.next != &req->queue || ep->stopped)
+			return 0;
+
+		if (udc_start_dma(ep, req))
+			return 0;
+
+		/* prime both FIFO halves, or take what already arrived */
+		if (ep_is_in(ep))
+			udc_fill_fifo(ep);
+		else
+			udc_drain_fifo(ep);
+		return 0;
+	}
+
 	if (list_empty(&ep->queue) && !ep->stopped) {
 		offset = ep_index(ep) ? UDC_ESR : UDC_EP0SR;
 		esr = readw(udc->regs + offset);
@@ -563,6 +946,38 @@ static int udc_queue(struct udc_ep *ep, struct udc_req *req)
 	return 0;
 }
 
+/* endpoints are serviced from the UDC interrupt */
+static int udc_queue(struct udc_ep *ep, struct udc_req *req)
+{
+	u32 flags;
+	int ret;
+
+	flags = irq_save();
+	ret = __udc_queue(ep, req);
+	irq_restore(flags);
+
+	return ret;
+}
+
+/* completes a queued request with -ECONNRESET, stopping it if started */
+static int udc_dequeue(struct udc_ep *ep, struct udc_req *req)
+{
+	u32 flags;
+
+	flags = irq_save();
+	if (list_empty(&req->queue)) {
+		irq_restore(flags);
+		return -EINVAL;
+	}
+
+	if (ep->queue.next == &req->queue)
+		udc_stop_dma(ep);
+	udc_complete_req(ep, req, -ECONNRESET);
+	irq_restore(flags);
+
+	return 0;
+}
+
 void udc_fifo_flush(struct udc_ep *ep)
 {
 	struct udc *udc = ep->dev;
@@ -575,7 +990,7 @@ void udc_fifo_flush(struct udc_ep *ep)
 		ecr |= UDC_ECR_FLUSH;
 		writew(ecr, udc->regs + UDC_ECR);
 	} else {
-		while ((readw(udc->regs + UDC_ESR) >> 2) & 3) {
+		while (udc_fifo_packets(udc)) {
 			count = readw(udc->regs + UDC_BRCR);
 			while (count--)
 				readw(ep->fifo);
@@ -589,6 +1004,7 @@ static struct udc_ep_ops udc_ep_ops = {
 	.alloc_req = udc_alloc_req,
 	.free_req = udc_free_req,
 	.queue = udc_queue,
+	.dequeue = udc_dequeue,
 	.set_halt = udc_set_halt,
 	.fifo_flush = udc_fifo_flush,
 };
@@ -615,6 +1031,7 @@ static void udc_init_ep(struct udc *udc, u8 epnum)
 
 	ep->fifo = udc->regs + UDC_BR(epnum);
 	ep->stopped = 0;
+	udc_stop_dma(ep);
 
 	set_index(udc, epnum);
 	writew(ep->maxpacket, udc->regs + UDC_MPR);
@@ -637,7 +1054,7 @@ static void udc_reconfig(struct udc *udc)
 	udc->speed = USB_SPEED_UNKNOWN;
 }
 
-void udc_task(void)
+static void udc_irq(void)
 {
 	struct udc *udc = &_udc;
 	struct udc_ep *ep;
@@ -645,6 +1062,8 @@ void udc_task(void)
 	u16 sys_status;
 	u8 epnum;
 
+	udc_schedule();
+
 	sys_status = readw(udc->regs + UDC_SSR);
 	ep_intr = readw(udc->regs + UDC_EIR);
 
@@ -709,11 +1128,43 @@ void udc_task(void)
 	}
 }
 
+void udc_schedule(void)
+{
+	event_post(&udc_event);
+}
+
+/* work that is too slow for the interrupt handler */
+void udc_task(void)
+{
+	struct udc *udc = &_udc;
+	u32 flags;
+	int epnum;
+
+	trace(TRACE_UDC_TASK, 0);
+
+	flags = irq_save();
+	udc_dma_task(udc);
+	irq_restore(flags);
+
+	if (udc->driver && udc->driver->task)
+		udc->driver->task(udc);
+
+	for (epnum = 1; epnum < NUM_ENDPOINTS; epnum++)
+		if (udc->ep[epnum].dma_length)
+			udc_schedule();
+}
+
+static void udc_task_event(void *arg)
+{
+	udc_task();
+}
+
 int udc_init(struct udc_driver *driver)
 {
 	struct udc *udc = &_udc;
 	u16 cfg;
 	volatile int delay;
+	int epnum, i;
 
 	if (!driver)
 		return -EINVAL;
@@ -723,6 +1174,19 @@ int udc_init(struct udc_driver *driver)
 	udc->state = USB_STATE_NOTATTACHED;
 	udc->driver = driver;
 
+	/* nothing touches the DMA controller in a PIO only build */
+	if (UDC_DMA_EPS)
+		dma_init();
+	for (epnum = 0; epnum < NUM_ENDPOINTS; epnum++) {
+		udc->ep[epnum].dma_ch = -1;
+		if (UDC_DMA_EPS & (1 << epnum))
+			udc->ep[epnum].dma_ch = dma_request();
+
+		for (i = 0; i < UDC_REQ_POOL; i++)
+			udc->ep[epnum].req_free[i] = &udc_req_pool[epnum][i];
+		udc->ep[epnum].req_nfree = UDC_REQ_POOL;
+	}
+
 	/* enable clock */
 	writel(UDC_CLKGEN_CLKSRC_EXT | UDC_CLKGEN_CLKDIV(0),
 			udc->regs + UDC_CLKGEN);
@@ -743,6 +1207,6 @@ int udc_init(struct udc_driver *driver)
 	if (udc->driver->init)
 		udc->driver->init(udc);
 
-	return 0;
+	return irq_request(IRQ_UDC, udc_irq);
 }
 
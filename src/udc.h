@@ -26,6 +26,7 @@
 #include "linux/usb/ch9.h"
 
 #define NUM_ENDPOINTS 3
+#define UDC_REQ_POOL 8 /* alloc_req requests per endpoint */
 
 struct udc;
 struct udc_ep;
@@ -45,17 +46,34 @@ struct udc_driver {
 					struct usb_ctrlrequest *ctrl);
 	void			(*vbuson)(struct udc *udc);
 	void			(*vbusoff)(struct udc *udc);
+	void			(*task)(struct udc *udc);
+};
+
+/*
+ * A request with sg set moves its segments in order as one transfer
+ * and completes once.  buf and length are filled in by queue, and every
+ * segment but the last must be an even number of bytes.
+ */
+struct udc_sg {
+	void			*buf;
+	unsigned int		length;
 };
 
 struct udc_req {
 	void			*buf;
 	unsigned int		length;
 	unsigned int		actual;
+	struct udc_sg		*sg;
+	int			num_sgs;
 	bool			zero;
 	void			(*complete)(struct udc_ep *ep,
 					struct udc_req *req);
 	int			status;
 	struct list_head	queue;
+
+	/* position in sg, kept by the controller */
+	int			sg_index;
+	unsigned int		sg_offset;
 };
 
 struct udc_ep_ops {
@@ -73,14 +91,29 @@ struct udc_ep_ops {
 	void 			(*fifo_flush)(struct udc_ep *ep);
 };
 
+struct udc_ep_stats {
+	u32			packets;
+	u32			bytes;
+	u32			fifo_empty;	/* IN: both halves drained */
+	u32			fifo_full;	/* OUT: both halves filled */
+	u32			errors;		/* requests ended by an error */
+	u32			reqs;		/* from alloc_req, in use */
+	u32			reqs_max;	/* high water mark of reqs */
+};
+
 struct udc_ep {
 	void __iomem		*fifo;
 	u8			address;
 	u8			stopped;
 	u16			maxpacket;
+	int			dma_ch;
+	u32			dma_length;
 	struct udc		*dev;
 	struct udc_ep_ops	*ops;
 	struct list_head	queue;
+	struct udc_ep_stats	stats;
+	struct udc_req		*req_free[UDC_REQ_POOL];
+	int			req_nfree;
 };
 
 struct udc {
@@ -94,6 +127,7 @@ struct udc {
 };
 
 int udc_init(struct udc_driver *driver);
+void udc_schedule(void);
 void udc_task(void);
 
 #endif /* _UDC_H  */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2013 Jeff Kent <jeff@jkent.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _USBTOOL_PROTOCOL_H
+#define _USBTOOL_PROTOCOL_H
+
+#include "asm/types.h"
+
+/* never a printable character, so it can't start a text command */
+#define USBTOOL_CMD_MAGIC	(0xB5)
+#define USBTOOL_CMD_VERSION	(1)
+#define USBTOOL_CMD_MAX_ARGS	(4)
+
+enum usbtool_opcode {
+	USBTOOL_OP_BUFFER_READ = 0,
+	USBTOOL_OP_BUFFER_WRITE,
+	USBTOOL_OP_NAND_SELECT,
+	USBTOOL_OP_NAND_INFO,
+	USBTOOL_OP_NAND_BAD,
+	USBTOOL_OP_NAND_READ,
+	USBTOOL_OP_NAND_ERASE,
+	USBTOOL_OP_NAND_WRITE,
+	USBTOOL_OP_NAND_MARK,
+	USBTOOL_OP_NAND_STREAM,		/* raw, -EINVAL while nand ecc is on */
+	USBTOOL_OP_NAND_PROGRAM,
+	USBTOOL_OP_NAND_SPAN,
+	USBTOOL_OP_NAND_READ2,
+	USBTOOL_OP_NAND_ERASE2,
+	USBTOOL_OP_NAND_WRITE2,
+	USBTOOL_OP_NAND_ECC,
+	USBTOOL_OP_NAND_ECCREP,
+	USBTOOL_OP_NAND_SAVEBBT,
+	USBTOOL_OP_NAND_HASH,		/* raw, -EINVAL while nand ecc is on */
+	USBTOOL_OP_TRACE_DUMP,
+	USBTOOL_OP_STATS_GET,
+	USBTOOL_OP_STATS_RESET,
+	NUM_USBTOOL_OPS,
+};
+
+/* nand span modes, for stream and program across both chips */
+enum usbtool_span {
+	USBTOOL_SPAN_NONE = 0,	/* the selected chip only */
+	USBTOOL_SPAN_CONCAT,	/* chip 0 blocks, then chip 1 blocks */
+	USBTOOL_SPAN_STRIPE,	/* even blocks on chip 0, odd on chip 1 */
+};
+
+/*
+ * usbtool_cmd.flags of nand stream: each block is preceded by a bitmap
+ * of its erased pages, one bit per page padded to 4 bytes, sent as its
+ * own transfer.  Only the pages that aren't erased follow.
+ */
+#define USBTOOL_STREAM_SKIP_ERASED	(1 << 0)
+
+/*
+ * usbtool_cmd.flags of nand write and nand program: each block is read
+ * back raw and compared with what was sent.  The response ends with a
+ * list of struct usbtool_mismatch, one per page that differs, as its
+ * own transfer.  nand program also sets the block's bit in its status
+ * bitmap, so nothing is lost if the list fills up.
+ */
+#define USBTOOL_PROGRAM_VERIFY		(1 << 1)
+
+/*
+ * usbtool_cmd.flags of nand stream: each block is sent as the data area
+ * of every page followed by the OOB of every page, read apart in one
+ * pass.  Not together with USBTOOL_STREAM_SKIP_ERASED.
+ */
+#define USBTOOL_STREAM_SPLIT_OOB	(1 << 2)
+
+/* the firmware sends its struct nand_mismatch list as this */
+struct usbtool_mismatch {
+	u32 page;
+	u32 bits;	/* bits that differ, data and OOB */
+};
+
+struct usbtool_cmd {
+	u8 magic;
+	u8 version;
+	u8 opcode;
+	u8 argc;
+	u32 tag;
+	u32 flags;
+	u32 reserved;
+	u64 arg[USBTOOL_CMD_MAX_ARGS];
+};
+
+/* sent on the bulk-IN endpoint after any payload of a binary command */
+struct usbtool_completion {
+	u8 magic;
+	u8 version;
+	u8 opcode;
+	u8 reserved;
+	u32 tag;
+	s32 status;
+};
+
+/* what stats get sends, little endian, in this layout */
+#define USBTOOL_STATS_VERSION	(1)
+#define USBTOOL_STATS_OPS	(32) /* room for opcodes yet to come */
+
+struct usbtool_ep_stats {
+	u32 packets;
+	u32 bytes;
+	u32 fifo_empty;	/* IN: both FIFO halves ran dry */
+	u32 fifo_full;	/* OUT: both FIFO halves were full */
+	u32 errors;
+	u32 reqs_max;
+};
+
+struct usbtool_nand_stats {
+	u32 pages_read;
+	u32 pages_programmed;
+	u32 blocks_erased;
+	u32 wait_ticks;	/* chip busy, also while USB runs */
+	u32 errors;	/* program and erase failures */
+	u32 ecc_corrected;
+	u32 ecc_failed;
+};
+
+struct usbtool_stats {
+	u32 version;
+	u32 hz;		/* of ticks and wait_ticks */
+	u32 ticks;	/* since the last stats reset, wraps after ~466 s */
+	struct usbtool_ep_stats in;
+	struct usbtool_ep_stats out;
+	struct usbtool_nand_stats nand[2];
+	u32 commands[USBTOOL_STATS_OPS];
+	u32 command_errors;
+};
+
+#endif /* _USBTOOL_PROTOCOL_H */
@@ -15,44 +15,195 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "asm/io.h"
 #include "baremetal/util.h"
+#include "mach/nand.h"
 
+#include "crc32.h"
+#include "irq.h"
 #include "nand.h"
+#include "trace.h"
 #include "udc.h"
 #include "usbtool_descriptors.h"
+#include "usbtool_protocol.h"
 
 #define BUFFER_START (0x1000000) /* 16 MB */
 #define BUFFER_SIZE  (0x1000000) /* 16 MB */
 
+#define STREAM_SLOTS (4)
+#define HASH_SLOTS (2)
+#define PROGRAM_SLOTS (3)
+#define CMD_QUEUE_LEN (8)
+#define VERIFY_MAX (1024)
+
+struct stream {
+	bool active;
+	bool skip_erased;
+	bool split_oob;
+	int block;
+	int end_block;
+	int pending;
+	int head;
+	int tx;
+	u8 ready;
+	int status;	/* of the first block that failed */
+};
+
+struct hash {
+	bool active;
+	int first_block;
+	int block;
+	int end_block;
+	int pending;
+	int status;	/* of the first block that failed */
+};
+
+/* program slot states */
+#define SLOT_RECV	(0)
+#define SLOT_FILLED	(1)
+#define SLOT_BUSY	(2)
+
+struct program {
+	bool active;
+	bool verify;
+	int first_block;
+	int end_block;
+	int recv_block;
+	int done;
+	int block[PROGRAM_SLOTS];
+	u8 state[PROGRAM_SLOTS];
+};
+
+struct command_entry;
+
+struct command {
+	const char *group;
+	const char *name;
+	u8 argc;
+	u8 flags;
+	int (*handler)(struct command_entry *cmd);
+};
+
+struct command_entry {
+	const struct command *command;
+	bool binary;
+	u8 opcode;
+	u32 tag;
+	u32 flags;
+	int status;
+	u64 arg[USBTOOL_CMD_MAX_ARGS];
+};
+
+struct command_queue {
+	struct command_entry entry[CMD_QUEUE_LEN];
+	struct command_entry *running;
+	int head;
+	int count;
+	int completion_head;
+	int completions;
+	bool receiving;
+	bool received;	/* command_req holds a command not yet parsed */
+	bool rx_busy;
+};
 
 static struct udc_req setup_req = {0};
 static struct udc_req command_req = {0};
+static struct udc_req response_req = {0};
 static struct udc_req buffer_req = {0};
-
-static u16 command_buf[256];
-
-static void command_request(struct udc_ep *ep, struct udc_req *req);
-static void command_response(struct udc_ep *ep, struct udc_req *req);
+static struct udc_req stream_req[STREAM_SLOTS] = {{0}};
+static struct udc_req stream_map_req[STREAM_SLOTS] = {{0}};
+static struct udc_req program_req[PROGRAM_SLOTS] = {{0}};
+static struct udc_req status_req = {0};
+static struct udc_req verify_req = {0};
+static struct nand_op stream_op[STREAM_SLOTS];
+static struct nand_op program_op[PROGRAM_SLOTS];
+static int span_mode = USBTOOL_SPAN_NONE;
+
+static struct stream stream = {0};
+static u32 stream_map[STREAM_SLOTS][NAND_MAX_BLOCK_PAGES / 32];
+static struct udc_sg stream_sg[STREAM_SLOTS][NAND_MAX_BLOCK_PAGES / 2];
+static struct program program = {0};
+static u8 program_status[2 * NAND_MAX_BLOCKS / 8];
+static struct nand_mismatch verify_list[VERIFY_MAX + NAND_MAX_BLOCK_PAGES];
+/* goes out as is, so it has to stay laid out like usbtool_mismatch */
+typedef char verify_list_matches_wire[(sizeof(struct nand_mismatch) ==
+		sizeof(struct usbtool_mismatch)) ? 1 : -1];
+static int verify_count;
+static int verify_status;
+static struct hash hash = {0};
+static struct nand_op hash_op[HASH_SLOTS];
+static int hash_index[HASH_SLOTS];
+static u32 hash_crc[2 * NAND_MAX_BLOCKS];
+
+static struct {
+	struct trace_header hdr;
+	struct trace_entry entry[TRACE_LEN];
+} trace_dump;
+
+static struct usbtool_stats stats;
+static u32 stats_start;
+
+static struct command_queue cmdq = {{{0}}};
+static struct usbtool_completion completion_buf[CMD_QUEUE_LEN];
+static u16 command_buf[256] __attribute__((aligned(8)));
+
+static void command_receive(void);
 
 static struct udc_ep *tx_ep;
 static struct udc_ep *rx_ep;
 
 
-static void configured(struct udc *udc)
+/* maps a block of the stream/program address space to a chip block */
+static int span_map(int block, int *chipnr)
 {
-	if (list_empty(&rx_ep->queue)) {
-		command_req.length = sizeof(command_buf) - 2;
-		command_req.complete = command_request;
-		INIT_LIST_HEAD(&command_req.queue);
+	switch (span_mode) {
+	case USBTOOL_SPAN_CONCAT:
+		*chipnr = block >= nand_get_chip(0)->num_blocks;
+		return block - *chipnr * nand_get_chip(0)->num_blocks;
 
-		rx_ep->ops->queue(rx_ep, &command_req);
+	case USBTOOL_SPAN_STRIPE:
+		*chipnr = block & 1;
+		return block >> 1;
+
+	default:
+		*chipnr = nand_chip->num;
+		return block;
 	}
 }
 
+static int span_blocks(void)
+{
+	if (span_mode == USBTOOL_SPAN_NONE)
+		return nand_chip->num_blocks;
+
+	return nand_get_chip(0)->num_blocks + nand_get_chip(1)->num_blocks;
+}
+
+/* the NAND engine reads raw, whatever nand ecc is set to */
+static bool span_ecc(void)
+{
+	if (span_mode == USBTOOL_SPAN_NONE)
+		return nand_chip->ecc_mode != 0;
+
+	return nand_get_chip(0)->ecc_mode || nand_get_chip(1)->ecc_mode;
+}
+
+static void configured(struct udc *udc)
+{
+	/* anything in flight was nuked when the endpoints were disabled */
+	bzero(&cmdq, sizeof(cmdq));
+	stream.active = false;
+	program.active = false;
+	hash.active = false;
+	span_mode = USBTOOL_SPAN_NONE;
+
+	command_receive();
+}
+
 static inline int process_req_desc(struct udc *udc,
 		struct usb_ctrlrequest *ctrl)
 {
@@ -216,197 +367,1138 @@ static int process_setup(struct udc *udc, struct usb_ctrlrequest *ctrl)
 	return -1;
 }
 
-static void command_response(struct udc_ep *ep, struct udc_req *req)
+static void command_done(void);
+
+/* ends the running command early, with status in its completion */
+static void command_fail(int status)
 {
-	if (req->status)
+	if (cmdq.running)
+		cmdq.running->status = status;
+	command_done();
+}
+
+/* stream_task finishes the command, with the error if there was one */
+static void stream_complete(struct udc_ep *ep, struct udc_req *req)
+{
+	stream.pending--;
+	if (req->status && !stream.status)
+		stream.status = req->status;
+	udc_schedule();
+}
+
+/*
+ * A block with nothing but erased pages is only its map.  Otherwise the
+ * data request behind it accounts for the slot.
+ */
+static void stream_map_complete(struct udc_ep *ep, struct udc_req *req)
+{
+	if (!stream_req[req - stream_map_req].length) {
+		stream_complete(ep, req);
 		return;
+	}
 
-	req->buf = command_buf;
-	req->length = sizeof(command_buf) - 2;
-	req->complete = command_request;
+	if (req->status && !stream.status)
+		stream.status = req->status;
+}
+
+/* queue overwrites buf of a request with segments */
+static inline void *stream_slot(int i)
+{
+	int block_size = nand_chip->pages_per_block * nand_chip->read_size;
 
-	ep->ops->queue(rx_ep, req);
+	return (void *)(BUFFER_START + i * block_size);
 }
 
-static void command_request(struct udc_ep *ep, struct udc_req *req)
+/*
+ * Records the erased pages of a slot in its map and sends the rest
+ * straight from where they were read, one segment per run of pages.
+ */
+static void stream_compact(int i)
+{
+	struct udc_req *req = &stream_req[i];
+	struct udc_sg *sg = NULL;
+	int size = nand_chip->read_size;
+	void *mem = stream_slot(i);
+	int page;
+
+	bzero(stream_map[i], sizeof(stream_map[i]));
+	req->num_sgs = 0;
+	req->length = 0;
+	for (page = 0; page < nand_chip->pages_per_block; page++) {
+		if (nand_page_erased(mem, size)) {
+			stream_map[i][page / 32] |= 1 << (page % 32);
+			sg = NULL;
+		} else if (sg) {
+			sg->length += size;
+			req->length += size;
+		} else {
+			sg = &req->sg[req->num_sgs++];
+			sg->buf = mem;
+			sg->length = size;
+			req->length += size;
+		}
+		mem += size;
+	}
+}
+
+/* sends finished reads in address order, whichever chip was faster */
+static void stream_read_complete(struct nand_op *op)
+{
+	int i = op - stream_op;
+	u32 flags;
+	int j;
+
+	if (!stream.active)
+		return;
+
+	/*
+	 * Nothing goes out after a failed block, stream_task finishes the
+	 * command once the blocks still in flight are back.
+	 */
+	if (op->status || stream.status) {
+		flags = irq_save();
+		if (!stream.status)
+			stream.status = (op->status < 0) ? op->status : -EIO;
+		stream.pending--;
+		for (j = 0; j < STREAM_SLOTS; j++)
+			if (stream.ready & (1 << j))
+				stream.pending--;
+		stream.ready = 0;
+		irq_restore(flags);
+		udc_schedule();
+		return;
+	}
+
+	if (stream.skip_erased)
+		stream_compact(i);
+
+	stream.ready |= 1 << i;
+	while (stream.ready & (1 << stream.tx)) {
+		stream.ready &= ~(1 << stream.tx);
+		if (stream.skip_erased)
+			tx_ep->ops->queue(tx_ep, &stream_map_req[stream.tx]);
+		if (stream_req[stream.tx].length)
+			tx_ep->ops->queue(tx_ep, &stream_req[stream.tx]);
+		stream.tx = (stream.tx + 1) % STREAM_SLOTS;
+	}
+}
+
+/* a slot is a whole block, so the NAND engine can use cache read */
+static void stream_start(int first_block, int count, bool skip_erased,
+		bool split_oob)
+{
+	int i;
+
+	for (i = 0; i < STREAM_SLOTS; i++) {
+		stream_req[i].buf = stream_slot(i);
+		stream_req[i].sg = skip_erased ? stream_sg[i] : NULL;
+		stream_op[i].count = nand_chip->pages_per_block;
+		stream_map_req[i].length = max(4,
+				nand_chip->pages_per_block / 8);
+	}
+
+	stream.skip_erased = skip_erased;
+	stream.split_oob = split_oob;
+	stream.block = first_block;
+	stream.end_block = first_block + count;
+	stream.pending = 0;
+	stream.head = 0;
+	stream.tx = 0;
+	stream.ready = 0;
+	stream.status = 0;
+	stream.active = true;
+}
+
+static void stream_task(void)
+{
+	int ppb = nand_chip->pages_per_block;
+	struct nand_op *op;
+	int chipnr, block, status;
+	u32 flags;
+
+	if (!stream.active)
+		return;
+
+	/* keep every free slot reading while the previous ones drain */
+	while (!stream.status && stream.block < stream.end_block &&
+			stream.pending < STREAM_SLOTS) {
+		op = &stream_op[stream.head];
+		block = span_map(stream.block, &chipnr);
+		op->chip = chipnr;
+		op->page = block * ppb;
+		op->buf = stream_slot(stream.head);
+		op->oob = NULL;
+		if (stream.split_oob)
+			op->oob = op->buf + ppb * nand_chip->info.page_size;
+		stream_req[stream.head].length = ppb * nand_chip->read_size;
+
+		flags = irq_save();
+		stream.block++;
+		stream.pending++;
+		stream.head = (stream.head + 1) % STREAM_SLOTS;
+		irq_restore(flags);
+
+		status = nand_submit(op);
+		if (status) {
+			flags = irq_save();
+			stream.status = status;
+			stream.pending--;
+			irq_restore(flags);
+		}
+	}
+
+	if ((stream.status || stream.block == stream.end_block) &&
+			!stream.pending) {
+		stream.active = false;
+		command_fail(stream.status);
+	}
+}
+
+static void program_complete(struct udc_ep *ep, struct udc_req *req)
+{
+	int i;
+
+	if (!program.active)
+		return;
+
+	/* the blocks still coming must not land in the other slots */
+	if (req->status) {
+		program.active = false;
+		for (i = 0; i < PROGRAM_SLOTS; i++)
+			rx_ep->ops->dequeue(rx_ep, &program_req[i]);
+		command_fail(req->status);
+		return;
+	}
+
+	program.state[req - program_req] = SLOT_FILLED;
+	udc_schedule();
+}
+
+/* hands a slot to the host for the next block, if any are left */
+static void program_receive(int i)
+{
+	u32 flags;
+
+	flags = irq_save();
+	if (program.recv_block < program.end_block) {
+		program.block[i] = program.recv_block++;
+		program.state[i] = SLOT_RECV;
+		rx_ep->ops->queue(rx_ep, &program_req[i]);
+	}
+	irq_restore(flags);
+}
+
+static void program_start(int first_block, int count, bool verify)
+{
+	int block_size = nand_chip->pages_per_block * nand_chip->read_size;
+	int i;
+
+	bzero(program_status, sizeof(program_status));
+	verify_count = 0;
+
+	program.verify = verify;
+	program.first_block = first_block;
+	program.end_block = first_block + count;
+	program.recv_block = first_block;
+	program.done = 0;
+	program.active = true;
+
+	for (i = 0; i < PROGRAM_SLOTS; i++) {
+		program_req[i].buf = (void *)(BUFFER_START + i * block_size);
+		program_req[i].length = block_size;
+		program.state[i] = SLOT_BUSY;
+		program_receive(i);
+	}
+}
+
+static void program_block_done(int i, int status)
+{
+	int bit = program.block[i] - program.first_block;
+	int count = program.end_block - program.first_block;
+
+	if (status)
+		program_status[bit >> 3] |= 1 << (bit & 7);
+
+	program.state[i] = SLOT_BUSY;
+	program_receive(i);
+
+	if (++program.done < count)
+		return;
+
+	program.active = false;
+
+	/* response_complete or verify_complete finishes the command */
+	if (!program.verify) {
+		response_req.buf = program_status;
+		response_req.length = min((count + 7) / 8,
+				(int)sizeof(program_status));
+		tx_ep->ops->queue(tx_ep, &response_req);
+		return;
+	}
+
+	status_req.buf = program_status;
+	status_req.length = min((count + 7) / 8,
+			(int)sizeof(program_status));
+	tx_ep->ops->queue(tx_ep, &status_req);
+
+	verify_status = 0;
+	verify_req.length = min(verify_count, VERIFY_MAX) *
+			sizeof(struct nand_mismatch);
+	tx_ep->ops->queue(tx_ep, &verify_req);
+}
+
+static void program_verify_complete(struct nand_op *op)
+{
+	int i = op - program_op;
+	int ppb = nand_chip->pages_per_block;
+	int n = 0;
+
+	if (!program.active)
+		return;
+
+	/* past VERIFY_MAX entries only the status bitmap is kept */
+	if (op->status >= 0)
+		n = nand_compare_pages(program.block[i] * ppb, ppb,
+				program_req[i].buf, op->buf,
+				verify_list + min(verify_count, VERIFY_MAX));
+	verify_count += n;
+
+	program_block_done(i, op->status < 0 || n);
+}
+
+static void program_write_complete(struct nand_op *op)
+{
+	int i = op - program_op;
+	int ppb = nand_chip->pages_per_block;
+	int block_size = ppb * nand_chip->read_size;
+	int chipnr;
+
+	if (!program.active)
+		return;
+
+	if (!program.verify || op->status < 0 ||
+			(op->status & NAND_STATUS_FAIL)) {
+		program_block_done(i, op->status < 0 ||
+				(op->status & NAND_STATUS_FAIL));
+		return;
+	}
+
+	/* read back into the slot's own area past the receive slots */
+	op->type = NAND_OP_READ;
+	op->page = span_map(program.block[i], &chipnr) * ppb;
+	op->buf = (void *)(BUFFER_START + (PROGRAM_SLOTS + i) * block_size);
+	op->complete = program_verify_complete;
+	nand_submit(op);
+}
+
+static void program_erase_complete(struct nand_op *op)
+{
+	int i = op - program_op;
+
+	if (!program.active)
+		return;
+
+	if (op->status < 0 || (op->status & NAND_STATUS_FAIL)) {
+		program_block_done(i, 1);
+		return;
+	}
+
+	op->type = NAND_OP_PROGRAM;
+	op->count = nand_chip->pages_per_block;
+	op->buf = program_req[i].buf;
+	op->complete = program_write_complete;
+	nand_submit(op);
+}
+
+/*
+ * Each filled slot is erased and then programmed by the NAND engine.
+ * Slots that map to different chips run at the same time.
+ */
+static void program_task(void)
+{
+	int ppb = nand_chip->pages_per_block;
+	struct nand_op *op;
+	int i, chipnr, block;
+
+	if (!program.active)
+		return;
+
+	for (i = 0; i < PROGRAM_SLOTS; i++) {
+		if (program.state[i] != SLOT_FILLED)
+			continue;
+
+		program.state[i] = SLOT_BUSY;
+		block = span_map(program.block[i], &chipnr);
+
+		op = &program_op[i];
+		op->chip = chipnr;
+		op->type = NAND_OP_ERASE;
+		op->page = block * ppb;
+		op->count = 1;
+		op->complete = program_erase_complete;
+		nand_submit(op);
+	}
+}
+
+/* runs from nand_task, which has the op's chip selected */
+static void hash_read_complete(struct nand_op *op)
+{
+	int size = nand_chip->pages_per_block * nand_chip->read_size;
+	int i = op - hash_op;
+
+	if (!hash.active)
+		return;
+
+	hash.pending--;
+	if (op->status) {
+		if (!hash.status)
+			hash.status = (op->status < 0) ? op->status : -EIO;
+	} else {
+		hash_crc[hash_index[i]] = crc32(0, op->buf, size);
+	}
+
+	udc_schedule();
+}
+
+/*
+ * Keeps a block read in flight per slot, through the span mapping like
+ * stream, so with stripe both chips read while the CRCs are taken.
+ */
+static void hash_task(void)
+{
+	int ppb = nand_chip->pages_per_block;
+	struct nand_op *op;
+	int i, chipnr, block, status;
+
+	if (!hash.active)
+		return;
+
+	for (i = 0; i < HASH_SLOTS; i++) {
+		op = &hash_op[i];
+		if (hash.status || hash.block == hash.end_block)
+			break;
+		if (!list_empty(&op->queue))
+			continue;
+
+		block = span_map(hash.block, &chipnr);
+		op->chip = chipnr;
+		op->page = block * ppb;
+		op->count = ppb;
+		op->buf = stream_slot(i);
+		op->oob = NULL;
+		hash_index[i] = hash.block - hash.first_block;
+
+		hash.block++;
+		hash.pending++;
+		status = nand_submit(op);
+		if (status) {
+			hash.status = status;
+			hash.pending--;
+		}
+	}
+
+	if (hash.pending || (!hash.status && hash.block < hash.end_block))
+		return;
+
+	hash.active = false;
+
+	if (hash.status) {
+		command_fail(hash.status);
+		return;
+	}
+
+	/* response_complete finishes the command */
+	response_req.buf = hash_crc;
+	response_req.length = (hash.end_block - hash.first_block) * 4;
+	tx_ep->ops->queue(tx_ep, &response_req);
+}
+
+/* the mismatch list went out, the command gets the status held back */
+static void verify_complete(struct udc_ep *ep, struct udc_req *req)
 {
 	if (req->status)
 		return;
 
-	char *buf = (char *)req->buf;
-	buf[req->actual] = '\0';
+	cmdq.running->status = verify_status;
+	command_done();
+}
 
+static void response_complete(struct udc_ep *ep, struct udc_req *req)
+{
+	if (req->status)
+		return;
+
+	command_done();
+}
+
+/*
+ * Command handlers return a status for the completion record, or
+ * -EINPROGRESS when a completion callback will call command_done().
+ */
+static int cmd_buffer_read(struct command_entry *cmd)
+{
+	/* buffer offset */
+	u32 offset = cmd->arg[0] & (BUFFER_SIZE - 1) & ~1;
+	response_req.buf = (u16 *)(BUFFER_START + offset);
+
+	/* read size */
+	response_req.length = min(BUFFER_SIZE - offset, cmd->arg[1] & ~1);
+
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static int cmd_buffer_write(struct command_entry *cmd)
+{
+	/* buffer offset */
+	u32 offset = cmd->arg[0] & (BUFFER_SIZE - 1) & ~1;
+	buffer_req.buf = (u16 *)(BUFFER_START + offset);
+
+	/* write size */
+	buffer_req.length = min(BUFFER_SIZE - offset, cmd->arg[1] & ~1);
+
+	rx_ep->ops->queue(rx_ep, &buffer_req);
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_select(struct command_entry *cmd)
+{
+	/* chip number */
+	if (cmd->arg[0] >= NAND_MAX_CHIPS)
+		return -EINVAL;
+
+	nand_select_chip(cmd->arg[0]);
+	return 0;
+}
+
+static int cmd_nand_info(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	response_req.buf = &nand_chip->info;
+	response_req.length = sizeof(struct nand_info);
+
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_bad(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	response_req.buf = nand_chip->bbt;
+	response_req.length = nand_chip->num_blocks / 4;
+
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_read(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* buffer offset */
+	u32 offset = cmd->arg[1] & (BUFFER_SIZE - 1) & ~3;
+	void *mem = (void *)(BUFFER_START + offset);
+
+	/* bits corrected, or -EBADMSG */
+	return nand_read_block(block, mem);
+}
+
+static int cmd_nand_erase(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	return nand_erase_block(block);
+}
+
+static int cmd_nand_write(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* buffer offset */
+	u32 offset = cmd->arg[1] & (BUFFER_SIZE - 1) & ~3;
+	void *mem = (void *)(BUFFER_START + offset);
+
+	verify_status = nand_write_block(block, mem);
+	if (!(cmd->flags & USBTOOL_PROGRAM_VERIFY))
+		return verify_status;
+
+	/* a block that failed to program isn't worth comparing */
+	verify_count = 0;
+	if (!verify_status)
+		verify_count = nand_verify_block(block, mem, verify_list);
+
+	verify_req.length = verify_count * sizeof(struct nand_mismatch);
+	tx_ep->ops->queue(tx_ep, &verify_req);
+	return -EINPROGRESS;
+}
+
+/* the two-plane variants take the even block of a pair */
+static int cmd_nand_read2(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] + 1 >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* buffer offset */
+	u32 offset = cmd->arg[1] & (BUFFER_SIZE - 1) & ~3;
+	void *mem = (void *)(BUFFER_START + offset);
+
+	/* bits corrected in both blocks, or -EBADMSG */
+	return nand_read_block_pair(block, mem);
+}
+
+static int cmd_nand_erase2(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] + 1 >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	return nand_erase_block_pair(block);
+}
+
+static int cmd_nand_write2(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] + 1 >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* buffer offset */
+	u32 offset = cmd->arg[1] & (BUFFER_SIZE - 1) & ~3;
+	void *mem = (void *)(BUFFER_START + offset);
+
+	return nand_write_block_pair(block, mem);
+}
+
+static int cmd_nand_ecc(struct command_entry *cmd)
+{
+	/* layout in bits 0-7, algorithm in bits 8-15 */
+	return nand_set_ecc(cmd->arg[0] & 0xFF, (cmd->arg[0] >> 8) & 0xFF);
+}
+
+/* per page ECC results of the last block read */
+static int cmd_nand_eccrep(struct command_entry *cmd)
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return -EINVAL;
+
+	response_req.buf = nand_chip->ecc_report;
+	response_req.length = nand_chip->pages_per_block;
+
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_mark(struct command_entry *cmd)
+{
+	if (!nand_chip)
+		return -EINVAL;
+
+	/* block number */
+	if (cmd->arg[0] >= nand_chip->num_blocks)
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* mark */
+	u8 mark = (u8)cmd->arg[1] & 0x3;
+
+	int byte_num = block >> 2;
+	int shift = (block & 0x3) * 2;
+
+	nand_chip->bbt[byte_num] &= ~(0x3 << shift);
+	nand_chip->bbt[byte_num] |= mark << shift;
+
+	return 0;
+}
+
+/* persists the table, including any "nand mark" changes */
+static int cmd_nand_savebbt(struct command_entry *cmd)
+{
+	return nand_bbt_save();
+}
+
+static int cmd_nand_stream(struct command_entry *cmd)
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return -EINVAL;
+
+	/* first block */
+	if (cmd->arg[0] >= span_blocks())
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* block count */
+	int count = min(span_blocks() - cmd->arg[0], cmd->arg[1]);
+	if (!count)
+		return -EINVAL;
+
+	if ((cmd->flags & USBTOOL_STREAM_SKIP_ERASED) &&
+			(cmd->flags & USBTOOL_STREAM_SPLIT_OOB))
+		return -EINVAL;
+
+	if (span_ecc())
+		return -EINVAL;
+
+	stream_start(block, count,
+			(cmd->flags & USBTOOL_STREAM_SKIP_ERASED) != 0,
+			(cmd->flags & USBTOOL_STREAM_SPLIT_OOB) != 0);
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_program(struct command_entry *cmd)
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return -EINVAL;
+
+	/* first block */
+	if (cmd->arg[0] >= span_blocks())
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* block count, one status bit each */
+	int count = min(span_blocks() - cmd->arg[0], cmd->arg[1]);
+	count = min(count, (int)sizeof(program_status) * 8);
+	if (!count)
+		return -EINVAL;
+
+	program_start(block, count,
+			(cmd->flags & USBTOOL_PROGRAM_VERIFY) != 0);
+	return -EINPROGRESS;
+}
+
+/* always the whole ring, hdr.count says how much of it is valid */
+static int cmd_trace_dump(struct command_entry *cmd)
+{
+	trace_dump.hdr.hz = trace_hz();
+	trace_dump.hdr.count = trace_snapshot(trace_dump.entry);
+
+	response_req.buf = &trace_dump;
+	response_req.length = sizeof(trace_dump);
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static void stats_copy_ep(struct usbtool_ep_stats *dst, struct udc_ep *ep)
+{
+	dst->packets = ep->stats.packets;
+	dst->bytes = ep->stats.bytes;
+	dst->fifo_empty = ep->stats.fifo_empty;
+	dst->fifo_full = ep->stats.fifo_full;
+	dst->errors = ep->stats.errors;
+	dst->reqs_max = ep->stats.reqs_max;
+}
+
+/*
+ * Everything a slow unit needs to show whether it waits on USB or on
+ * NAND: wait_ticks against ticks, and the FIFO stalls.
+ */
+static int cmd_stats_get(struct command_entry *cmd)
+{
+	struct nand_chip *chip;
+	int i;
+
+	stats.version = USBTOOL_STATS_VERSION;
+	stats.hz = trace_hz();
+	stats.ticks = trace_time() - stats_start;
+	stats_copy_ep(&stats.in, tx_ep);
+	stats_copy_ep(&stats.out, rx_ep);
+
+	for (i = 0; i < NAND_MAX_CHIPS; i++) {
+		chip = nand_get_chip(i);
+		stats.nand[i].pages_read = chip->stats.pages_read;
+		stats.nand[i].pages_programmed = chip->stats.pages_programmed;
+		stats.nand[i].blocks_erased = chip->stats.blocks_erased;
+		stats.nand[i].wait_ticks = chip->stats.wait_ticks;
+		stats.nand[i].errors = chip->stats.errors;
+		stats.nand[i].ecc_corrected = chip->ecc_corrected;
+		stats.nand[i].ecc_failed = chip->ecc_failed;
+	}
+
+	response_req.buf = &stats;
+	response_req.length = sizeof(stats);
+	tx_ep->ops->queue(tx_ep, &response_req);
+	return -EINPROGRESS;
+}
+
+static void stats_reset_ep(struct udc_ep *ep)
+{
+	u32 reqs = ep->stats.reqs;
+
+	bzero(&ep->stats, sizeof(ep->stats));
+	ep->stats.reqs = reqs;
+	ep->stats.reqs_max = reqs;
+}
+
+static int cmd_stats_reset(struct command_entry *cmd)
+{
+	struct nand_chip *chip;
+	u32 flags;
+	int i;
+
+	flags = irq_save();
+	stats_reset_ep(tx_ep);
+	stats_reset_ep(rx_ep);
+	irq_restore(flags);
+
+	for (i = 0; i < NAND_MAX_CHIPS; i++) {
+		chip = nand_get_chip(i);
+		bzero(&chip->stats, sizeof(chip->stats));
+		chip->ecc_corrected = 0;
+		chip->ecc_failed = 0;
+	}
+
+	/* this command is counted once it returns */
+	bzero(&stats, sizeof(stats));
+	stats_start = trace_time();
+	return 0;
+}
+
+/*
+ * CRC32 of each block as read, data and OOB.  With ECC on the OOB holds
+ * parity the host's image doesn't, so every block would mismatch.
+ */
+static int cmd_nand_hash(struct command_entry *cmd)
+{
+	if (!nand_chip || !nand_chip->info.known)
+		return -EINVAL;
+
+	if (span_ecc())
+		return -EINVAL;
+
+	/* first block */
+	if (cmd->arg[0] >= span_blocks())
+		return -EINVAL;
+	int block = cmd->arg[0];
+
+	/* block count */
+	int count = min(span_blocks() - cmd->arg[0], cmd->arg[1]);
+	if (!count)
+		return -EINVAL;
+
+	hash.first_block = block;
+	hash.block = block;
+	hash.end_block = block + count;
+	hash.pending = 0;
+	hash.status = 0;
+	hash.active = true;
+	return -EINPROGRESS;
+}
+
+static int cmd_nand_span(struct command_entry *cmd)
+{
+	struct nand_chip *chip0 = nand_get_chip(0);
+	struct nand_chip *chip1 = nand_get_chip(1);
+
+	/* mode */
+	if (cmd->arg[0] > USBTOOL_SPAN_STRIPE)
+		return -EINVAL;
+
+	/* both chips must share a geometry */
+	if (cmd->arg[0] != USBTOOL_SPAN_NONE && (!chip0->info.known ||
+			!chip1->info.known ||
+			chip0->num_blocks != chip1->num_blocks ||
+			chip0->pages_per_block != chip1->pages_per_block ||
+			chip0->read_size != chip1->read_size))
+		return -ENODEV;
+
+	span_mode = cmd->arg[0];
+	return span_blocks();
+}
+
+/*
+ * CMD_RX: the command consumes bulk-OUT data, so no further commands
+ *         are received until it is done.
+ * CMD_STATUS: text commands reply with a 2-byte status.
+ */
+#define CMD_RX		(1 << 0)
+#define CMD_STATUS	(1 << 1)
+
+static const struct command commands[NUM_USBTOOL_OPS] = {
+	[USBTOOL_OP_BUFFER_READ]  = {"buffer", "read",    2, 0,
+			cmd_buffer_read},
+	[USBTOOL_OP_BUFFER_WRITE] = {"buffer", "write",   2, CMD_RX,
+			cmd_buffer_write},
+	[USBTOOL_OP_NAND_SELECT]  = {"nand",   "select",  1, 0,
+			cmd_nand_select},
+	[USBTOOL_OP_NAND_INFO]    = {"nand",   "info",    0, 0,
+			cmd_nand_info},
+	[USBTOOL_OP_NAND_BAD]     = {"nand",   "bad",     0, 0,
+			cmd_nand_bad},
+	[USBTOOL_OP_NAND_READ]    = {"nand",   "read",    2, 0,
+			cmd_nand_read},
+	[USBTOOL_OP_NAND_ERASE]   = {"nand",   "erase",   1, CMD_STATUS,
+			cmd_nand_erase},
+	[USBTOOL_OP_NAND_WRITE]   = {"nand",   "write",   2, CMD_STATUS,
+			cmd_nand_write},
+	[USBTOOL_OP_NAND_MARK]    = {"nand",   "mark",    2, 0,
+			cmd_nand_mark},
+	[USBTOOL_OP_NAND_STREAM]  = {"nand",   "stream",  2, 0,
+			cmd_nand_stream},
+	[USBTOOL_OP_NAND_PROGRAM] = {"nand",   "program", 2, CMD_RX,
+			cmd_nand_program},
+	[USBTOOL_OP_NAND_SPAN]    = {"nand",   "span",    1, CMD_STATUS,
+			cmd_nand_span},
+	[USBTOOL_OP_NAND_READ2]   = {"nand",   "read2",   2, 0,
+			cmd_nand_read2},
+	[USBTOOL_OP_NAND_ERASE2]  = {"nand",   "erase2",  1, CMD_STATUS,
+			cmd_nand_erase2},
+	[USBTOOL_OP_NAND_WRITE2]  = {"nand",   "write2",  2, CMD_STATUS,
+			cmd_nand_write2},
+	[USBTOOL_OP_NAND_ECC]     = {"nand",   "ecc",     1, CMD_STATUS,
+			cmd_nand_ecc},
+	[USBTOOL_OP_NAND_ECCREP]  = {"nand",   "eccrep",  0, 0,
+			cmd_nand_eccrep},
+	[USBTOOL_OP_NAND_SAVEBBT] = {"nand",   "savebbt", 0, CMD_STATUS,
+			cmd_nand_savebbt},
+	[USBTOOL_OP_NAND_HASH]    = {"nand",   "hash",    2, 0,
+			cmd_nand_hash},
+	[USBTOOL_OP_TRACE_DUMP]   = {"trace",  "dump",    0, 0,
+			cmd_trace_dump},
+	[USBTOOL_OP_STATS_GET]    = {"stats",  "get",     0, 0,
+			cmd_stats_get},
+	[USBTOOL_OP_STATS_RESET]  = {"stats",  "reset",   0, CMD_STATUS,
+			cmd_stats_reset},
+};
+
+/* legacy "<group> <command> [hex args]" grammar */
+static const struct command *parse_text(char *buf, u64 *arg)
+{
 	char group[9], command[9];
-	u32 n1, n2, n3, n4;
-	int ret;
+	u32 n[USBTOOL_CMD_MAX_ARGS];
+	int i, ret;
 
-	ret = sscanf(buf, "%8s %8s %8x %8x %8x %8x", group, command, &n1, &n2, &n3, &n4);
+	ret = sscanf(buf, "%8s %8s %8x %8x %8x %8x", group, command,
+			&n[0], &n[1], &n[2], &n[3]);
 	if (ret < 2)
-		goto requeue;
-
-	if (strcmp(group, "buffer") == 0) {
-		if (strcmp(command, "read") == 0) {
-			if (ret != 4)
-				goto requeue;
-
-			/* buffer offset */
-			u32 offset = n1 & (BUFFER_SIZE - 1) & ~1;
-			buffer_req.buf = (u16 *)(BUFFER_START + offset);
-
-			/* read size */
-			buffer_req.length = min(BUFFER_START - offset,
-					n2 & ~1);
-
-			ep->ops->queue(tx_ep, &buffer_req);
-			return;
-		} 
-		if (strcmp(command, "write") == 0) {
-			if (ret != 4)
-				goto requeue;
-
-			/* buffer offset */
-			u32 offset = n1 & (BUFFER_SIZE - 1) & ~1;
-			buffer_req.buf = (u16 *)(BUFFER_START + offset);
-
-			/* write size */
-			buffer_req.length = min(BUFFER_START - offset,
-					n2 & ~1);
-
-			ep->ops->queue(rx_ep, &buffer_req);
-			return;
-		}
-		goto requeue;
+		return NULL;
+
+	for (i = 0; i < ret - 2; i++)
+		arg[i] = n[i];
+
+	for (i = 0; i < NUM_USBTOOL_OPS; i++) {
+		if (strcmp(group, commands[i].group) != 0 ||
+				strcmp(command, commands[i].name) != 0)
+			continue;
+
+		if (ret - 2 != commands[i].argc)
+			return NULL;
+
+		return &commands[i];
 	}
 
-	if (strcmp(group, "nand") == 0) {
-		if (strcmp(command, "select") == 0) {
-			if (ret != 3)
-				goto requeue;
+	return NULL;
+}
 
-			/* chip number */
-			if (n1 >= NAND_MAX_CHIPS)
-				goto requeue;
+static const struct command *parse_binary(struct usbtool_cmd *cmd, u64 *arg)
+{
+	int i;
 
-			nand_select_chip(n1);
-			goto requeue;
-		}
-		if (strcmp(command, "info") == 0) {
-			if (ret != 2)
-				goto requeue;
+	if (cmd->version != USBTOOL_CMD_VERSION ||
+			cmd->opcode >= NUM_USBTOOL_OPS ||
+			cmd->argc != commands[cmd->opcode].argc)
+		return NULL;
 
-			if (!nand_chip)
-				goto requeue;
+	for (i = 0; i < cmd->argc; i++)
+		arg[i] = cmd->arg[i];
 
-			req->buf = &nand_chip->info;
-			req->length = sizeof(struct nand_info);
-			req->complete = command_response;
+	return &commands[cmd->opcode];
+}
 
-			tx_ep->ops->queue(tx_ep, req);
-			return;
-		}
-		if (strcmp(command, "bad") == 0) {
-			if (ret != 2)
-				goto requeue;
+static void command_receive(void)
+{
+	u32 flags;
 
-			if (!nand_chip)
-				goto requeue;
+	flags = irq_save();
+	if (!cmdq.receiving && !cmdq.received && !cmdq.rx_busy &&
+			cmdq.count < CMD_QUEUE_LEN) {
+		cmdq.receiving = true;
+		command_req.buf = command_buf;
+		command_req.length = sizeof(command_buf) - 2;
+		rx_ep->ops->queue(rx_ep, &command_req);
+	}
+	irq_restore(flags);
+}
 
-			req->buf = nand_chip->bbt;
-			req->length = nand_chip->num_blocks / 4;
-			req->complete = command_response;
+/* runs in the UDC interrupt, so parsing is left to command_parse */
+static void command_request(struct udc_ep *ep, struct udc_req *req)
+{
+	cmdq.receiving = false;
+	if (req->status)
+		return;
 
-			tx_ep->ops->queue(tx_ep, req);
-			return;
-		}
-		if (strcmp(command, "read") == 0) {
-			if (ret != 4)
-				goto requeue;
-
-			if (!nand_chip)
-				goto requeue;
-
-			/* block number */
-			if (n1 >= nand_chip->num_blocks)
-				goto requeue;
-			int block = n1;
-
-			/* buffer offset */
-			u32 offset = n2 & (BUFFER_SIZE - 1) & ~3;
-			void *mem = (void *)(BUFFER_START + offset);
-			
-			nand_read_block(block, mem);
-			goto requeue;
-		}
-		if (strcmp(command, "erase") == 0) {
-			if (ret != 3)
-				goto requeue;
+	cmdq.received = true;
+	udc_schedule();
+}
 
-			if (!nand_chip)
-				goto requeue;
+static void command_parse(void)
+{
+	struct udc_req *req = &command_req;
+	struct command_entry *cmd;
+	struct usbtool_cmd *hdr = req->buf;
+	char *buf = (char *)req->buf;
+	u32 flags;
 
-			/* block number */
-			if (n1 >= nand_chip->num_blocks)
-				goto requeue;
-			int block = n1;
+	if (!cmdq.received)
+		return;
 
-			((u16 *)req->buf)[0] = nand_erase_block(block);
-			req->length = 2;
-			req->complete = command_response;
+	/* the slot past the queued commands, command_done can't move it */
+	flags = irq_save();
+	cmd = &cmdq.entry[(cmdq.head + cmdq.count) % CMD_QUEUE_LEN];
+	irq_restore(flags);
+
+	if (req->actual >= sizeof(struct usbtool_cmd) &&
+			hdr->magic == USBTOOL_CMD_MAGIC) {
+		cmd->binary = true;
+		cmd->opcode = hdr->opcode;
+		cmd->tag = hdr->tag;
+		cmd->flags = hdr->flags;
+		cmd->command = parse_binary(hdr, cmd->arg);
+	} else {
+		buf[req->actual] = '\0';
+		cmd->binary = false;
+		cmd->tag = 0;
+		cmd->flags = 0;
+		cmd->command = parse_text(buf, cmd->arg);
+		if (!cmd->command)
+			goto receive;
+		cmd->opcode = cmd->command - commands;
+	}
 
-			tx_ep->ops->queue(tx_ep, req);
-			return;
-		}
-		if (strcmp(command, "write") == 0) {
-			if (ret != 4)
-				goto requeue;
-
-			if (!nand_chip)
-				goto requeue;
-
-			/* block number */
-			if (n1 >= nand_chip->num_blocks)
-				goto requeue;
-			int block = n1;
-
-			/* buffer offset */
-			u32 offset = n2 & (BUFFER_SIZE - 1) & ~3;
-			void *mem = (void *)(BUFFER_START + offset);
-			
-			((u16 *)req->buf)[0] = nand_write_block(block, mem);
-			req->length = 2;
-			req->complete = command_response;
+	trace(TRACE_CMD_PARSE, cmd->opcode);
 
-			tx_ep->ops->queue(tx_ep, req);
-			return;
-		}
-		if (strcmp(command, "mark") == 0) {
-			if (ret != 4)
-				goto requeue;
+	flags = irq_save();
+	if (cmd->command && (cmd->command->flags & CMD_RX))
+		cmdq.rx_busy = true;
+	cmdq.count++;
+	irq_restore(flags);
+
+receive:
+	cmdq.received = false;
+	command_receive();
+}
+
+static void completion_complete(struct udc_ep *ep, struct udc_req *req)
+{
+	cmdq.completion_head = (cmdq.completion_head + 1) % CMD_QUEUE_LEN;
+	cmdq.completions--;
+	ep->ops->free_req(ep, req);
+	udc_schedule();
+}
+
+/* command_task holds commands back so that alloc_req can't run dry */
+#if UDC_REQ_POOL < CMD_QUEUE_LEN
+#error "completion records need a request each"
+#endif
 
-			if (!nand_chip)
-				goto requeue;
+/* sends the completion record of the running command and retires it */
+static void command_done(void)
+{
+	struct command_entry *cmd = cmdq.running;
+	struct usbtool_completion *rec;
+	struct udc_req *req;
+	u32 flags;
+	int i;
 
-			/* block number */
-			if (n1 >= nand_chip->num_blocks)
-				goto requeue;
-			int block = n1;
+	if (!cmd)
+		return;
 
-			/* mark */
-			u8 mark = (u8)n2 & 0x3;
+	flags = irq_save();
 
-			int byte_num = block >> 2;
-			int shift = (block & 0x3) * 2;
+	if (cmd->binary || (cmd->command->flags & CMD_STATUS)) {
+		i = (cmdq.completion_head + cmdq.completions) % CMD_QUEUE_LEN;
+		rec = &completion_buf[i];
+		req = tx_ep->ops->alloc_req(tx_ep);
+		req->complete = completion_complete;
 
-			nand_chip->bbt[byte_num] &= ~(0x3 << shift);
-			nand_chip->bbt[byte_num] |= mark << shift;
+		rec->magic = USBTOOL_CMD_MAGIC;
+		rec->version = USBTOOL_CMD_VERSION;
+		rec->opcode = cmd->opcode;
+		rec->reserved = 0;
+		rec->tag = cmd->tag;
+		rec->status = cmd->status;
 
-			goto requeue;
+		if (cmd->binary) {
+			req->buf = rec;
+			req->length = sizeof(*rec);
+		} else {
+			/* low half of the little endian status */
+			req->buf = &rec->status;
+			req->length = 2;
 		}
-		goto requeue;
+
+		cmdq.completions++;
+		tx_ep->ops->queue(tx_ep, req);
 	}
 
-requeue:
-	ep->ops->queue(ep, req);
+	if (cmd->command && (cmd->command->flags & CMD_RX))
+		cmdq.rx_busy = false;
+
+	cmdq.running = NULL;
+	cmdq.head = (cmdq.head + 1) % CMD_QUEUE_LEN;
+	cmdq.count--;
+
+	command_receive();
+	irq_restore(flags);
+
+	udc_schedule();
+}
+
+static void command_task(void)
+{
+	struct command_entry *cmd;
+
+	/* a completion slot must be free before a command may run */
+	if (cmdq.running || !cmdq.count || cmdq.completions >= CMD_QUEUE_LEN)
+		return;
+
+	cmd = &cmdq.entry[cmdq.head];
+	cmdq.running = cmd;
+
+	if (cmd->command)
+		cmd->status = cmd->command->handler(cmd);
+	else
+		cmd->status = -EINVAL;
+
+	if (cmd->opcode < USBTOOL_STATS_OPS)
+		stats.commands[cmd->opcode]++;
+	if (cmd->status < 0 && cmd->status != -EINPROGRESS)
+		stats.command_errors++;
+
+	if (cmd->status != -EINPROGRESS)
+		command_done();
 }
 
 static void buffer_req_complete(struct udc_ep *ep, struct udc_req *req)
@@ -414,11 +1506,26 @@ static void buffer_req_complete(struct udc_ep *ep, struct udc_req *req)
 	if (req->status)
 		return;
 
-	ep->ops->queue(rx_ep, &command_req);
+	command_done();
+}
+
+static void task(struct udc *udc)
+{
+	command_parse();
+	command_task();
+	stream_task();
+	program_task();
+	hash_task();
+
+	/* come back while there is still work that no interrupt will kick */
+	if (!cmdq.running && cmdq.count && cmdq.completions < CMD_QUEUE_LEN)
+		udc_schedule();
 }
 
 static void init(struct udc *udc)
 {
+	int i;
+
 	tx_ep = &udc->ep[1];
 	rx_ep = &udc->ep[2];
 
@@ -427,12 +1534,46 @@ static void init(struct udc *udc)
 	command_req.complete = command_request;
 	INIT_LIST_HEAD(&command_req.queue);
 
+	response_req.complete = response_complete;
+	INIT_LIST_HEAD(&response_req.queue);
+
 	buffer_req.complete = buffer_req_complete;
 	INIT_LIST_HEAD(&buffer_req.queue);
+
+	for (i = 0; i < STREAM_SLOTS; i++) {
+		stream_req[i].complete = stream_complete;
+		INIT_LIST_HEAD(&stream_req[i].queue);
+		stream_map_req[i].buf = stream_map[i];
+		stream_map_req[i].complete = stream_map_complete;
+		INIT_LIST_HEAD(&stream_map_req[i].queue);
+		stream_op[i].type = NAND_OP_READ;
+		stream_op[i].complete = stream_read_complete;
+		INIT_LIST_HEAD(&stream_op[i].queue);
+	}
+
+	for (i = 0; i < HASH_SLOTS; i++) {
+		hash_op[i].type = NAND_OP_READ;
+		hash_op[i].complete = hash_read_complete;
+		INIT_LIST_HEAD(&hash_op[i].queue);
+	}
+
+	INIT_LIST_HEAD(&status_req.queue);
+
+	/* the host reads past the longest list, the ZLP ends its read */
+	verify_req.buf = verify_list;
+	verify_req.zero = true;
+	verify_req.complete = verify_complete;
+	INIT_LIST_HEAD(&verify_req.queue);
+
+	for (i = 0; i < PROGRAM_SLOTS; i++) {
+		program_req[i].complete = program_complete;
+		INIT_LIST_HEAD(&program_req[i].queue);
+		INIT_LIST_HEAD(&program_op[i].queue);
+	}
 }
 
 struct udc_driver usbtool_udc_driver = {
 	.setup = process_setup,
 	.init = init,
+	.task = task,
 };
-
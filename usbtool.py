@@ -5,6 +5,8 @@ import os
 import sys
 import struct
 import time
+import zlib
+from collections import deque
 
 root_dir = os.path.abspath(os.path.dirname(__file__))
 pyusb_dir = os.path.join(root_dir, 'pyusb')
@@ -18,10 +20,73 @@ if sys.platform == 'win32':
 import usb.core
 import usb.util
 
+CMD_MAGIC = 0xB5
+CMD_VERSION = 1
+CMD_MAX_ARGS = 4
+COMPLETION_SIZE = 12
+
+OPCODES = {
+    'buffer read':   0,
+    'buffer write':  1,
+    'nand select':   2,
+    'nand info':     3,
+    'nand bad':      4,
+    'nand read':     5,
+    'nand erase':    6,
+    'nand write':    7,
+    'nand mark':     8,
+    'nand stream':   9,
+    'nand program': 10,
+    'nand span':    11,
+    'nand read2':   12,
+    'nand erase2':  13,
+    'nand write2':  14,
+    'nand ecc':     15,
+    'nand eccrep':  16,
+    'nand savebbt': 17,
+    'nand hash':    18,
+    'trace dump':   19,
+    'stats get':    20,
+    'stats reset':  21,
+}
+
+SPAN_NONE = 0
+SPAN_CONCAT = 1
+SPAN_STRIPE = 2
+
+ECC_NONE = 0
+ECC_TAIL = 1
+ECC_HEAD = 2
+ECC_FAILED = 0xFF
+
+STREAM_SKIP_ERASED = 1 << 0
+PROGRAM_VERIFY = 1 << 1
+STREAM_SPLIT_OOB = 1 << 2
+VERIFY_MAX = 1024
+
+STATS_OPS = 32
+STATS_EP_FIELDS = ['packets', 'bytes', 'fifo_empty', 'fifo_full', 'errors',
+        'reqs_max']
+STATS_NAND_FIELDS = ['pages_read', 'pages_programmed', 'blocks_erased',
+        'wait_ticks', 'errors', 'ecc_corrected', 'ecc_failed']
+
+TRACE_LEN = 4096
+TRACE_EVENTS = ['udc task', 'req queue', 'req complete', 'nand cmd',
+        'nand wait', 'nand ready', 'cmd parse']
+(TRACE_UDC_TASK, TRACE_REQ_QUEUE, TRACE_REQ_COMPLETE, TRACE_NAND_CMD,
+        TRACE_NAND_WAIT, TRACE_NAND_READY, TRACE_CMD_PARSE) = range(7)
+
+ECC_HW_BCH4 = 0
+ECC_HAMMING = 1
+ECC_BCH4 = 2
+ECC_BCH8 = 3
 
 class UsbTool(object):
-    def __init__(self, device):
+    def __init__(self, device, binary=True):
         self.device = device
+        self.binary = binary
+        self.tag = 0
+        self.pending = deque()
 
         self.device.set_configuration()
         config_descriptor = self.device.get_active_configuration()
@@ -64,7 +129,12 @@ class UsbTool(object):
             data = data.tostring()
         return data
 
-    def command(self, *args):
+    def command(self, *args, **kwargs):
+        if self.binary:
+            self.write(self.pack_command(*args, **kwargs))
+            self.pending.append(self.tag)
+            return self.tag
+
         l = []
         for arg in args:
             if type(arg) is str:
@@ -76,12 +146,151 @@ class UsbTool(object):
         s = ' '.join(l)
         self.write(s)
 
+    def pack_command(self, name, *args, **kwargs):
+        opcode = OPCODES[name]
+        flags = kwargs.get('flags', 0)
+        if len(args) > CMD_MAX_ARGS:
+            raise ValueError("too many arguments")
+        for arg in args:
+            if type(arg) not in (int, long):
+                raise ValueError("invalid type")
+        self.tag = (self.tag + 1) & 0xFFFFFFFF
+        argv = list(args) + [0] * (CMD_MAX_ARGS - len(args))
+        return struct.pack('<BBBBIII4Q', CMD_MAGIC, CMD_VERSION, opcode,
+                len(args), self.tag, flags, 0, *argv)
+
+    def sync(self, keep=0):
+        """
+        Collect completion records until only `keep` commands remain
+        outstanding.  Call with keep=1 before reading the payload of the
+        most recent command.  Returns the status of the last record read.
+        """
+        status = None
+        while len(self.pending) > keep:
+            data = self.read(COMPLETION_SIZE)
+            magic, version, opcode, _, tag, status = \
+                    struct.unpack('<BBBBIi', data)
+            expected = self.pending.popleft()
+            if magic != CMD_MAGIC or tag != expected:
+                raise IOError('expected completion for tag %d' % expected)
+        return status
+
     def get_buffer(self):
         return Buffer(self, 16*1024*1024)
 
     def get_nand(self, num):
         return NandChip(self, num)
 
+    def get_nand_span(self, mode=SPAN_STRIPE):
+        return NandSpan(self, mode)
+
+    def trace_dump(self):
+        """
+        Empties the device trace ring.  Returns (hz, entries) with
+        entries as (ticks, event, arg), oldest first.  Firmware built
+        without TRACE_ENABLE always returns no entries.
+        """
+        self.command('trace dump')
+        self.sync(1)
+        data = self.read(8 + TRACE_LEN * 8)
+        hz, count = struct.unpack('<II', data[:8])
+        entries = []
+        for i in xrange(count):
+            entries.append(struct.unpack('<IHH', data[8 + i * 8:16 + i * 8]))
+        return hz, entries
+
+    def stats(self):
+        """
+        Device counters as a dict.  nand wait_ticks against ticks tells
+        how much of the time the flash was busy.  Both are u32 counts of
+        hz (9.216 MHz) and wrap after about 466 s, so reset the stats
+        shortly before the run being measured.
+        """
+        fields = 3 + 2 * len(STATS_EP_FIELDS) + \
+                2 * len(STATS_NAND_FIELDS) + STATS_OPS + 1
+        self.command('stats get')
+        self.sync(1)
+        words = list(struct.unpack('<%dI' % fields, self.read(fields * 4)))
+
+        def take(names):
+            values = words[:len(names)]
+            del words[:len(names)]
+            return dict(zip(names, values))
+
+        stats = take(['version', 'hz', 'ticks'])
+        stats['in'] = take(STATS_EP_FIELDS)
+        stats['out'] = take(STATS_EP_FIELDS)
+        stats['nand'] = [take(STATS_NAND_FIELDS) for i in xrange(2)]
+        names = dict((v, k) for k, v in OPCODES.items())
+        stats['commands'] = dict((names.get(op, op), count)
+                for op, count in enumerate(words[:STATS_OPS]) if count)
+        stats['command_errors'] = words[STATS_OPS]
+        return stats
+
+    def reset_stats(self):
+        self.command('stats reset')
+        if self.binary:
+            return self.sync() == 0
+        return struct.unpack('<h', self.read(2))[0] == 0
+
+def trace_phases(entries):
+    """
+    Pairs start and end events into (phase, start ticks, ticks taken):
+    NAND busy waits and requests from queue to completion.
+    """
+    phases = []
+    waits = {}
+    reqs = {}
+    for ticks, event, arg in entries:
+        if event == TRACE_NAND_WAIT:
+            waits[arg] = ticks
+        elif event == TRACE_NAND_READY and arg in waits:
+            name = 'nand busy (%s)' % ('irq' if arg else 'r/b')
+            start = waits.pop(arg)
+            phases.append((name, start, (ticks - start) & 0xffffffff))
+        elif event == TRACE_REQ_QUEUE:
+            reqs.setdefault(arg, deque()).append(ticks)
+        elif event == TRACE_REQ_COMPLETE and reqs.get(arg):
+            name = 'request ep%d %s' % (arg & 0x0f,
+                    'in' if arg & 0x80 else 'out')
+            start = reqs[arg].popleft()
+            phases.append((name, start, (ticks - start) & 0xffffffff))
+    return phases
+
+def trace_report(hz, entries, timeline=True):
+    """Prints the events with times in us and a histogram per phase."""
+    if not entries:
+        print 'trace is empty'
+        return
+
+    us = 1000000.0 / hz
+    if timeline:
+        prev = entries[0][0]
+        elapsed = 0
+        for ticks, event, arg in entries:
+            delta = (ticks - prev) & 0xffffffff
+            elapsed += delta
+            print '%12.2f %+10.2f  %-12s %d' % (elapsed * us, delta * us,
+                    TRACE_EVENTS[event], arg)
+            prev = ticks
+
+    histograms = {}
+    for name, start, ticks in trace_phases(entries):
+        bucket = 0
+        while (1 << bucket) <= ticks * us:
+            bucket += 1
+        counts = histograms.setdefault(name, {})
+        counts[bucket] = counts.get(bucket, 0) + 1
+
+    for name in sorted(histograms):
+        counts = histograms[name]
+        total = sum(counts.values())
+        print '%s, %d samples' % (name, total)
+        for bucket in sorted(counts):
+            low = (1 << bucket) >> 1
+            print '  %7d - %7d us %6d %s' % (low, 1 << bucket,
+                    counts[bucket], '#' * (counts[bucket] * 40 / total))
+
 class Buffer(object):
     def __init__(self, usbtool, size):
         self.usbtool = usbtool
@@ -105,6 +314,7 @@ class Buffer(object):
         if remainder:
             length += remainder
         self.usbtool.command('buffer read', offset, length)
+        self.usbtool.sync(1)
         data = self.usbtool.read(length)
         return data
 
@@ -114,11 +324,18 @@ class NandChip(object):
     def __init__(self, usbtool, chip_num):
         self.usbtool = usbtool
         self.chip_num = chip_num
+        self.mismatches = []
 
     def _select(self):
         if NandChip.selected != self.chip_num:
             self.usbtool.command('nand select', self.chip_num)
 
+    def _status(self):
+        if self.usbtool.binary:
+            return self.usbtool.sync()
+        data = self.usbtool.read(2)
+        return struct.unpack('<h', data)[0]
+
     def info(self):
         try:
             return self.info_dict
@@ -127,6 +344,7 @@ class NandChip(object):
 
         self._select()
         self.usbtool.command('nand info')
+        self.usbtool.sync(1)
         data = self.usbtool.read(20)
         keys = ['present', 'known', 'id', 'badblock_pos', 'num_planes',
                   'page_size', 'oob_size', 'block_size', 'chip_size']
@@ -142,9 +360,11 @@ class NandChip(object):
         return info
 
     def bad_blocks(self):
+        info = self.info()
         self._select()
         self.usbtool.command('nand bad')
-        data = self.usbtool.read(1024, False)
+        self.usbtool.sync(1)
+        data = self.usbtool.read(info['num_blocks'] / 4, False)
         bad_blocks = []
         block_num = 0
         for byte in data:
@@ -161,28 +381,193 @@ class NandChip(object):
     def erase_block(self, block_num):
         self._select()
         self.usbtool.command('nand erase', block_num)
-        data = self.usbtool.read(2)
-        result = struct.unpack('<h', data)[0]
-        if result == -1 or result & 1:
+        result = self._status()
+        if result < 0 or result & 1:
             return False
         return True
 
-    def write_block(self, block_num, buffer_offset=0):
+    def _read_mismatches(self):
+        """
+        The list ends with a short packet, or a zero length one when it
+        fills whole packets.  Asking for a packet more than the longest
+        list lets that ZLP end this read instead of the next one.
+        """
+        data = self.usbtool.read(VERIFY_MAX * 8 + 512)
+        count = len(data) / 8
+        words = struct.unpack('<%dI' % (count * 2), data)
+        return zip(words[0::2], words[1::2])
+
+    def write_block(self, block_num, buffer_offset=0, verify=False):
+        """
+        With verify, the device reads the block back and the
+        (page, bits) pairs that differ are left in self.mismatches.
+        """
         self._select()
-        self.usbtool.command('nand write', block_num, buffer_offset)
-        data = self.usbtool.read(2)
-        result = struct.unpack('<h', data)[0]
-        if result == -1 or result & 1:
+        flags = PROGRAM_VERIFY if verify else 0
+        self.usbtool.command('nand write', block_num, buffer_offset,
+                flags=flags)
+        if verify:
+            self.usbtool.sync(1)
+            self.mismatches = self._read_mismatches()
+        result = self._status()
+        if result < 0 or result & 1 or self.mismatches:
+            return False
+        return True
+
+    def read_block_pair(self, block_num, buffer_offset=0):
+        self._select()
+        self.usbtool.command('nand read2', block_num, buffer_offset)
+
+    def erase_block_pair(self, block_num):
+        self._select()
+        self.usbtool.command('nand erase2', block_num)
+        result = self._status()
+        if result < 0 or result & 1:
+            return False
+        return True
+
+    def write_block_pair(self, block_num, buffer_offset=0):
+        self._select()
+        self.usbtool.command('nand write2', block_num, buffer_offset)
+        result = self._status()
+        if result < 0 or result & 1:
             return False
         return True
 
+    def set_ecc(self, mode, algo=ECC_HW_BCH4):
+        self._select()
+        self.usbtool.command('nand ecc', mode | (algo << 8))
+        return self._status() == 0
+
+    def ecc_report(self):
+        """
+        Bits corrected in each page of the last block read, or
+        ECC_FAILED for a page that could not be corrected.
+        """
+        info = self.info()
+        self._select()
+        self.usbtool.command('nand eccrep')
+        self.usbtool.sync(1)
+        return list(self.usbtool.read(info['num_pages'], False))
+
     def mark_block(self, block_num, mark):
         self._select()
         self.usbtool.command('nand mark', block_num, mark)
 
-    def dump(self, filename):
+    def save_bbt(self):
+        self._select()
+        self.usbtool.command('nand savebbt')
+        return self._status() == 0
+
+    def hash_blocks(self, first_block, count):
+        """
+        CRC32 of each block as the device reads it, page data and OOB,
+        matching zlib.crc32 over the same bytes of an image.  The device
+        refuses while on-device ECC is enabled, as the parity it writes
+        into the OOB is not in the image.
+        """
+        self._select()
+        self.usbtool.command('nand hash', first_block, count)
+        self.usbtool.sync(1)
+        try:
+            data = self._read_payload(count * 4)
+        except IOError:
+            raise IOError('nand hash failed (is ECC enabled?)')
+        return list(struct.unpack('<%dI' % count, data))
+
+    def _read_payload(self, length, convert=True):
+        """
+        A failed stream or hash sends nothing after the bad block, so
+        the completion record turns up in place of the data.  Room is
+        left for a whole record, as a 4 or 8 byte erased-page map is
+        shorter than one and libusb would call that an overflow.
+        """
+        data = self.usbtool.read(max(length, COMPLETION_SIZE), convert)
+        if len(data) != length:
+            if self.usbtool.binary:
+                self.usbtool.pending.popleft()
+            raise IOError('nand read failed')
+        return data
+
+    def stream_blocks(self, first_block, count, skip_erased=None,
+            split_oob=False):
+        """
+        Yields (block_num, data).  With skip_erased, erased pages are not
+        sent and are filled back in with 0xFF here.  With split_oob, data
+        is (page data, oob) as two strings instead.  Pages are raw, so
+        the device refuses while on-device ECC is enabled.
+        """
+        info = self.info()
+        if skip_erased is None:
+            skip_erased = self.usbtool.binary and not split_oob
+        self._select()
+        flags = STREAM_SKIP_ERASED if skip_erased else 0
+        if split_oob:
+            flags |= STREAM_SPLIT_OOB
+        self.usbtool.command('nand stream', first_block, count, flags=flags)
+        self.usbtool.sync(1)
+        if split_oob:
+            data_size = info['page_size'] * info['num_pages']
+            for block_num in xrange(first_block, first_block + count):
+                data = self._read_payload(info['block_readsize'])
+                yield block_num, (data[:data_size], data[data_size:])
+            return
+        if not skip_erased:
+            for block_num in xrange(first_block, first_block + count):
+                yield block_num, self._read_payload(info['block_readsize'])
+            return
+
+        page_readsize = info['page_size'] + info['oob_size']
+        erased_page = '\xff' * page_readsize
+        map_size = max(4, info['num_pages'] / 8)
+        for block_num in xrange(first_block, first_block + count):
+            erased = self._read_payload(map_size, False)
+            is_erased = [bool(erased[i / 8] & (1 << (i % 8)))
+                    for i in xrange(info['num_pages'])]
+            programmed = is_erased.count(False)
+            data = ''
+            if programmed:
+                data = self._read_payload(programmed * page_readsize)
+            pages = []
+            offset = 0
+            for page_erased in is_erased:
+                if page_erased:
+                    pages.append(erased_page)
+                else:
+                    pages.append(data[offset:offset + page_readsize])
+                    offset += page_readsize
+            yield block_num, ''.join(pages)
+
+    def program_blocks(self, first_block, blocks, verify=False):
+        """
+        Returns the blocks that failed.  With verify, a block that reads
+        back different also fails and its pages are added to
+        self.mismatches, up to VERIFY_MAX per call.
+        """
+        info = self.info()
+        count = len(blocks)
+        self._select()
+        flags = PROGRAM_VERIFY if verify else 0
+        self.usbtool.command('nand program', first_block, count,
+                flags=flags)
+        for block_data in blocks:
+            self.usbtool.write(block_data)
+        self.usbtool.sync(1)
+        data = self.usbtool.read((count + 7) / 8, False)
+        if verify:
+            self.mismatches += self._read_mismatches()
+        failed = []
+        for i in xrange(count):
+            if data[i / 8] & (1 << (i % 8)):
+                failed.append(first_block + i)
+        return failed
+
+    def dump(self, filename, split_oob=False):
+        """
+        With split_oob, the page data goes to filename and the OOB of
+        every page to filename + '.oob'.
+        """
         info = self.info()
-        buf = self.usbtool.get_buffer()
 
         with open(filename + '.txt', 'w') as f:
             f.write('dump time:  %s\n' % time.asctime())
@@ -196,19 +581,149 @@ class NandChip(object):
                 bad_blocks = '(none)'
             f.write('bad blocks: %s\n' % bad_blocks)
 
+        oob_file = None
+        if split_oob:
+            oob_file = open(filename + '.oob', 'wb')
+
         with open(filename, 'wb') as f:
             print 'dumping NAND%d to %s' % (self.chip_num, filename)
-            for block_num in xrange(info['num_blocks']):
+            blocks = self.stream_blocks(0, info['num_blocks'],
+                    split_oob=split_oob)
+            for block_num, block_data in blocks:
+                percent = (float(block_num) / info['num_blocks']) * 100
+                sys.stdout.write('\x1b[2K\r%.1f%% complete' \
+                        % percent)
+                sys.stdout.flush()
+
+                if split_oob:
+                    f.write(block_data[0])
+                    oob_file.write(block_data[1])
+                else:
+                    f.write(block_data)
+
+            if oob_file:
+                oob_file.close()
+
+            print '\x1b[2K\rcompleted'
+
+    def program(self, filename, chunk_blocks=64, incremental=False,
+            verify=False):
+        """
+        With incremental, only blocks whose device hash differs from the
+        image are erased and programmed.  It needs ECC off, see
+        hash_blocks.  With verify, each block is read back and compared
+        on the device.
+        """
+        info = self.info()
+        self.mismatches = []
+
+        with open(filename, 'rb') as f:
+            print 'programming NAND%d from %s' % (self.chip_num, filename)
+            failed = []
+            for block_num in xrange(0, info['num_blocks'], chunk_blocks):
                 percent = (float(block_num) / info['num_blocks']) * 100
                 sys.stdout.write('\x1b[2K\r%.1f%% complete' \
                         % percent)
                 sys.stdout.flush()
 
-                self.read_block(block_num)
-                block_data = buf.read(info['block_readsize'])
-                f.write(block_data)
+                count = min(chunk_blocks, info['num_blocks'] - block_num)
+                blocks = []
+                for i in xrange(count):
+                    block = f.read(info['block_readsize'])
+                    if len(block) < info['block_readsize']:
+                        break
+                    blocks.append(block)
+                if not blocks:
+                    break
+
+                if not incremental:
+                    failed += self.program_blocks(block_num, blocks,
+                            verify)
+                    continue
+
+                hashes = self.hash_blocks(block_num, len(blocks))
+                run = None
+                for i in xrange(len(blocks) + 1):
+                    same = i == len(blocks) or \
+                            zlib.crc32(blocks[i]) & 0xffffffff == hashes[i]
+                    if not same and run is None:
+                        run = i
+                    elif same and run is not None:
+                        failed += self.program_blocks(block_num + run,
+                                blocks[run:i], verify)
+                        run = None
 
             print '\x1b[2K\rcompleted'
+            for block_num in failed:
+                print 'error programming block %d' % block_num
+            for page_num, bits in self.mismatches:
+                print 'page %d differs by %d bits' % (page_num, bits)
+            return failed
+
+class NandSpan(NandChip):
+    """
+    Both chips as one device for stream, program and hash.  In stripe mode
+    consecutive blocks alternate between the chips, so each chip works
+    while the other is busy.
+    """
+    def __init__(self, usbtool, mode=SPAN_STRIPE):
+        NandChip.__init__(self, usbtool, 0)
+        self.mode = mode
+        self.chips = [NandChip(usbtool, i) for i in xrange(2)]
+        self.usbtool.command('nand span', mode)
+        if self.usbtool.binary:
+            result = self.usbtool.sync()
+        else:
+            result = struct.unpack('<h', self.usbtool.read(2))[0]
+        if result < 0:
+            raise IOError('chips can not be spanned')
+
+    def info(self):
+        try:
+            return self.info_dict
+        except:
+            pass
+
+        info = dict(self.chips[0].info())
+        info['chip_size'] *= 2
+        info['num_blocks'] *= 2
+        self.info_dict = info
+        return info
+
+    def bad_blocks(self):
+        per_chip = self.chips[0].info()['num_blocks']
+        bad_blocks = []
+        for chip_num, chip in enumerate(self.chips):
+            for block_num in chip.bad_blocks():
+                if self.mode == SPAN_STRIPE:
+                    bad_blocks.append(block_num * 2 + chip_num)
+                else:
+                    bad_blocks.append(chip_num * per_chip + block_num)
+        return sorted(bad_blocks)
+
+    def read_block(self, block_num, buffer_offset=0):
+        raise NotImplementedError
+
+    def erase_block(self, block_num):
+        raise NotImplementedError
+
+    def write_block(self, block_num, buffer_offset=0, verify=False):
+        raise NotImplementedError
+
+    def read_block_pair(self, block_num, buffer_offset=0):
+        raise NotImplementedError
+
+    def erase_block_pair(self, block_num):
+        raise NotImplementedError
+
+    def write_block_pair(self, block_num, buffer_offset=0):
+        raise NotImplementedError
+
+    def mark_block(self, block_num, mark):
+        raise NotImplementedError
+
+    def save_bbt(self):
+        raise NotImplementedError
 
 
 if __name__ == '__main__':
@@ -238,24 +753,4 @@ if __name__ == '__main__':
 
         chip.dump('test.bin')
 
-"""
-        buf = usbtool.get_buffer()
-        with open('nc600-orig.bin', 'rb') as f:
-            for block_num in xrange(info['num_blocks']):
-                chip.mark_block(block_num,0)
-
-                percent = (float(block_num) / info['num_blocks']) * 100
-                sys.stdout.write('\x1b[2K\r%.1f%% complete' \
-                        % percent)
-                sys.stdout.flush()
-
-                block = f.read(info['block_readsize'])
-                if not chip.erase_block(block_num):
-                    print "error erasing block %d" % block_num
-
-                buf.write(block)
-                if not chip.write_block(block_num):
-                    print "error writing block %d" % block_num
-
-        print '\x1b[2K\rcompleted'
-"""
+#        chip.program('nc600-orig.bin')